@@ -0,0 +1,204 @@
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "graph.h"
+#include "matching.h"
+#include "naive_kopt.h"
+#include "permutation.h"
+#include "pruned_kopt.h"
+#include "retrieve_solution.h"
+#include "thread_pool.h"
+
+DEFINE_string(n, "2000,5000,10000", "comma-separated numbers of vertices of the random graphs");
+DEFINE_string(signature_n, "60", "comma-separated numbers of vertices of the random graphs of the k-opt kernels");
+DEFINE_int32(repeat, 1, "number of timed scans per kernel and graph, the fastest of which is reported");
+DEFINE_int32(threads, 1, "the number of threads of the parallel 3-opt scans");
+DEFINE_bool(pruned, false,
+            "instead of timing the scans, count the moves the pruned engine misses against the exhaustive scan");
+DEFINE_string(pruned_n, "100,50,24", "comma-separated numbers of vertices of the random graphs for k = 4, 5, ... "
+              "with --pruned");
+DEFINE_int32(graphs, 20, "number of random graphs per k with --pruned");
+
+namespace kopt {
+namespace {
+
+struct Kernel {
+  const char *name;
+  Kmove (*scan)(const Graph &);
+};
+
+const Kernel kKernels[] = {
+    {"3opt-rows", &Naive3optRowsBase},
+    {"3opt-tiled", &Naive3optBase},
+};
+
+// The scans of all the embeddings of a single signature, for k = 4 to 6.
+struct SignatureKernel {
+  const char *name;
+  Kmove (*scan)(MatchingId, const Graph &, bool first_improvement);
+};
+
+const SignatureKernel kSignatureKernels[] = {
+    {"incremental", [](MatchingId id, const Graph &graph, bool first) { return IncrementalKopt(id, graph, first); }},
+    {"revolving-door",
+     [](MatchingId id, const Graph &graph, bool first) { return IncrementalKopt(id, graph, first, true); }},
+    {"hoisted", &SignatureKopt},
+};
+
+std::vector<int> ParseSizes(const std::string &list) {
+  std::vector<int> sizes;
+  std::istringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    int n = std::atoi(item.c_str());
+    if (n <= 0) {
+      std::cerr << "Invalid size '" << item << "'\n";
+      std::exit(1);
+    }
+    sizes.emplace_back(n);
+  }
+  return sizes;
+}
+
+// Returns the fastest of --repeat runs of scan, in seconds, and sets *move to its result.
+template<class F>
+double Time(const F &scan, Kmove *move) {
+  double best = 0;
+  for (int i = 0; i < FLAGS_repeat; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    *move = scan();
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    if (i == 0 || seconds.count() < best)
+      best = seconds.count();
+  }
+  return best;
+}
+
+// Times full scans of the 3-opt kernels over a random graph of each size, in a random cycle order so that the
+// distances are not read in the order of the coordinates. Then times the best-improvement scans of the first
+// irreducible signature with k = 4, 5 and 6 edges.
+void Work() {
+  std::cout << "kernel,n,seconds,gain\n";
+  for (int n : ParseSizes(FLAGS_n)) {
+    auto graph = Graph::Random(n);
+    graph.Permutate(Permutation::Random(n));
+    for (auto &kernel : kKernels) {
+      Kmove move;
+      double seconds = Time([&] { return kernel.scan(graph); }, &move);
+      std::cout << kernel.name << ',' << n << ',' << seconds << ',' << move.gain << std::endl;
+    }
+  }
+  for (int n : ParseSizes(FLAGS_signature_n)) {
+    auto graph = Graph::Random(n);
+    graph.Permutate(Permutation::Random(n));
+    for (int k = 4; k <= 6; ++k) {
+      Matching matching(k);
+      matching.NextIrreducible();
+      for (auto &kernel : kSignatureKernels) {
+        Kmove move;
+        double seconds = Time([&] { return kernel.scan(matching.Id(), graph, false); }, &move);
+        std::cout << kernel.name << '-' << k << ',' << n << ',' << seconds << ',' << move.gain << std::endl;
+      }
+    }
+  }
+}
+
+// The number of alternating cycles of a signature with k removed edges, along which the removed edges (x, x ^ 1)
+// alternate with the added ones.
+int AlternatingCycles(const Matching &matching, int k) {
+  std::vector<bool> seen(2 * k);
+  int cycles = 0;
+  for (int x = 0; x < 2 * k; ++x) {
+    if (seen[x])
+      continue;
+    ++cycles;
+    for (int y = x; !seen[y]; y = matching(SigNode(y ^ 1)).id)
+      seen[y] = seen[y ^ 1] = true;
+  }
+  return cycles;
+}
+
+// Applies improving 2-opt and 3-opt moves until there are none, so that the moves measured are not ones of fewer edges.
+void MakeThreeOptimal(Graph *graph) {
+  while (true) {
+    Kmove move = Naive2optBase(*graph);
+    if (move.gain <= 0)
+      move = Naive3optBase(*graph);
+    if (move.gain <= 0)
+      return;
+    graph->ApplyPermutation(RetrieveSolution(graph->N(), Matching(move.matching_id), move.embedding));
+  }
+}
+
+// Compares the best-improvement searches of PrunedKopt and SignatureKopt for every irreducible signature with k = 4,
+// 5, ... edges, on --graphs random 3-opt optimal graphs per k. A signature is missed on a graph if the pruned search
+// finds a smaller gain, which should never happen to the signatures with a single alternating cycle. A graph is missed
+// if the best gain over all the signatures is smaller. The speedup is the ratio of the total times of the searches.
+void PrunedMisses() {
+  std::cout << "k,n,improving,missed,single_cycle_improving,single_cycle_missed,improving_graphs,missed_graphs,"
+               "speedup\n";
+  auto sizes = ParseSizes(FLAGS_pruned_n);
+  for (int k = 4; k < 4 + Size(sizes) && k <= 7; ++k) {
+    int n = sizes[k - 4];
+    std::vector<MatchingId> ids;
+    std::vector<bool> single_cycle;
+    Matching matching(k);
+    while (matching.NextIrreducible()) {
+      ids.emplace_back(matching.Id());
+      single_cycle.emplace_back(AlternatingCycles(matching, k) == 1);
+    }
+    int improving = 0, missed = 0, single_improving = 0, single_missed = 0, improving_graphs = 0, missed_graphs = 0;
+    double exhaustive_seconds = 0, pruned_seconds = 0;
+    for (int i = 0; i < FLAGS_graphs; ++i) {
+      auto graph = Graph::Random(n);
+      graph.Permutate(Permutation::Random(n));
+      MakeThreeOptimal(&graph);
+      int64_t best_exhaustive = 0, best_pruned = 0;
+      for (int s = 0; s < Size(ids); ++s) {
+        Kmove exhaustive, pruned;
+        exhaustive_seconds += Time([&] { return SignatureKopt(ids[s], graph, false); }, &exhaustive);
+        pruned_seconds += Time([&] { return PrunedKopt(ids[s], graph, false); }, &pruned);
+        best_exhaustive = std::max(best_exhaustive, exhaustive.gain);
+        best_pruned = std::max(best_pruned, pruned.gain);
+        if (exhaustive.gain <= 0)
+          continue;
+        ++improving;
+        missed += pruned.gain < exhaustive.gain;
+        if (single_cycle[s]) {
+          ++single_improving;
+          single_missed += pruned.gain < exhaustive.gain;
+        }
+      }
+      if (best_exhaustive > 0) {
+        ++improving_graphs;
+        missed_graphs += best_pruned < best_exhaustive;
+      }
+    }
+    std::cout << k << ',' << n << ',' << improving << ',' << missed << ',' << single_improving << ',' << single_missed
+              << ',' << improving_graphs << ',' << missed_graphs << ',' << exhaustive_seconds / pruned_seconds
+              << std::endl;
+  }
+}
+
+}  // namespace
+}  // namespace kopt
+
+int main(int argc, char **argv) {
+  gflags::SetUsageMessage("Benchmark the 3-opt and naive k-opt scans, or with --pruned, the misses of the pruned one");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  kopt::SetWorkers(FLAGS_threads);
+  if (FLAGS_pruned)
+    kopt::PrunedMisses();
+  else
+    kopt::Work();
+  return 0;
+}
@@ -0,0 +1,232 @@
+#include "checkpoint.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <utility>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "permutation.h"
+
+namespace kopt {
+namespace {
+
+constexpr char kHeader[] = "KOPT_CHECKPOINT 3";
+
+// Writes the contents to a new file at path and flushes it to the disk.
+bool WriteSynced(const std::string &path, const std::string &contents) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+  std::size_t written = 0;
+  while (written < contents.size()) {
+    ssize_t count = write(fd, contents.data() + written, contents.size() - written);
+    if (count < 0 && errno != EINTR)
+      break;
+    if (count > 0)
+      written += count;
+  }
+  bool ok = written == contents.size() && fsync(fd) == 0;
+  return close(fd) == 0 && ok;
+}
+
+sigset_t TerminationSet() {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGTERM);
+  return set;
+}
+
+// Flushes the entries of the directory holding path, e.g. after renaming a file into it.
+bool SyncDirectory(const std::string &path) {
+  auto slash = path.rfind('/');
+  std::string directory = slash == std::string::npos ? "." : path.substr(0, std::max<std::size_t>(slash, 1));
+  int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0)
+    return false;
+  bool ok = fsync(fd) == 0;
+  close(fd);
+  return ok;
+}
+
+}  // namespace
+
+bool SaveCheckpoint(const std::string &path, const Checkpoint &checkpoint) {
+  std::ostringstream out;
+  out << kHeader << '\n';
+  out << "N " << checkpoint.n << '\n';
+  out << "INPUT " << checkpoint.input_checksum << '\n';
+  out << "ALGORITHM " << checkpoint.algorithm << '\n';
+  out << "SIGNATURES " << checkpoint.signature_count << '\n';
+  out << "SHUFFLE_SIGNATURES " << checkpoint.shuffle_signatures << '\n';
+  out << "SPARSE_TABLES " << checkpoint.sparse_tables << '\n';
+  out << "CANDIDATES " << checkpoint.candidates << '\n';
+  out << "QUADRANT_CANDIDATES " << checkpoint.quadrant_candidates << '\n';
+  out << "CURSOR " << checkpoint.cursor << '\n';
+  out << "CLOCK " << checkpoint.clock << '\n';
+  out << "DEADLINE " << checkpoint.deadline << '\n';
+  out << "RNG " << checkpoint.rng << '\n';
+  out << "TOUR";
+  for (int v : checkpoint.tour)
+    out << ' ' << v;
+  out << '\n';
+
+  std::string tmp_path = path + ".tmp" + std::to_string(getpid());
+  if (!WriteSynced(tmp_path, out.str())) {
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  return std::rename(tmp_path.c_str(), path.c_str()) == 0 && SyncDirectory(path);
+}
+
+bool LoadCheckpoint(const std::string &path, Checkpoint *checkpoint, std::string *error) {
+  std::ifstream in(path);
+  if (!in) {
+    *error = "cannot open the file";
+    return false;
+  }
+  *checkpoint = Checkpoint();
+  std::string line;
+  if (!std::getline(in, line) || line != kHeader) {
+    *error = "not a checkpoint of this version";
+    return false;
+  }
+  // The fields in the order written by SaveCheckpoint.
+  auto field = [&](const char *key, auto *value) {
+    std::string name;
+    if (!std::getline(in, line) || !(std::istringstream(line) >> name >> *value) || name != key) {
+      *error = std::string("malformed ") + key + " line";
+      return false;
+    }
+    return true;
+  };
+  if (!field("N", &checkpoint->n) || !field("INPUT", &checkpoint->input_checksum) ||
+      !field("ALGORITHM", &checkpoint->algorithm) ||
+      !field("SIGNATURES", &checkpoint->signature_count) ||
+      !field("SHUFFLE_SIGNATURES", &checkpoint->shuffle_signatures) ||
+      !field("SPARSE_TABLES", &checkpoint->sparse_tables) || !field("CANDIDATES", &checkpoint->candidates) ||
+      !field("QUADRANT_CANDIDATES", &checkpoint->quadrant_candidates) || !field("CURSOR", &checkpoint->cursor) ||
+      !field("CLOCK", &checkpoint->clock) || !field("DEADLINE", &checkpoint->deadline))
+    return false;
+  if (!std::getline(in, line) || line.rfind("RNG ", 0) != 0) {
+    *error = "malformed RNG line";
+    return false;
+  }
+  checkpoint->rng = line.substr(4);
+  std::string name;
+  if (!(in >> name) || name != "TOUR") {
+    *error = "malformed TOUR line";
+    return false;
+  }
+  if (checkpoint->n < 0) {
+    *error = "negative N";
+    return false;
+  }
+  checkpoint->tour.resize(checkpoint->n);
+  for (int &v : checkpoint->tour) {
+    if (!(in >> v)) {
+      *error = "the tour ends early";
+      return false;
+    }
+  }
+  if (!IsPermutation(checkpoint->tour)) {
+    *error = "the tour is not a permutation";
+    return false;
+  }
+  if (checkpoint->cursor < 0 || checkpoint->cursor > checkpoint->signature_count) {
+    *error = "the cursor is out of range";
+    return false;
+  }
+  return true;
+}
+
+void BlockTermination() {
+  sigset_t set = TerminationSet();
+  pthread_sigmask(SIG_BLOCK, &set, nullptr);
+}
+
+CheckpointWriter::CheckpointWriter(std::string path, std::chrono::seconds interval)
+    : path_(std::move(path)), interval_(interval), thread_(&CheckpointWriter::Run, this) {}
+
+CheckpointWriter::~CheckpointWriter() {
+  Stop();
+}
+
+void CheckpointWriter::Update(Checkpoint checkpoint) {
+  if (path_.empty())
+    return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (checkpoint.tour.empty())
+    checkpoint.tour.swap(latest_.tour);
+  latest_ = std::move(checkpoint);
+  ++updates_;
+  stale_ = false;
+}
+
+void CheckpointWriter::Finish(const Checkpoint &checkpoint) {
+  Stop();
+  if (!path_.empty() && !SaveCheckpoint(path_, checkpoint))
+    std::cerr << "Failed to write the checkpoint '" << path_ << "'\n";
+}
+
+void CheckpointWriter::Stop() {
+  if (!thread_.joinable())
+    return;
+  stop_ = true;
+  // Wakes the thread up; SIGTERM sent to a thread which blocks it stays pending for that thread alone.
+  pthread_kill(thread_.native_handle(), SIGTERM);
+  thread_.join();
+}
+
+void CheckpointWriter::Run() {
+  sigset_t set = TerminationSet();
+  auto next = std::chrono::steady_clock::now() + interval_;
+  while (true) {
+    auto left = std::max(next - std::chrono::steady_clock::now(), std::chrono::steady_clock::duration::zero());
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(left);
+    timespec timeout{static_cast<std::time_t>(seconds.count()),
+                     static_cast<long>(std::chrono::duration_cast<std::chrono::nanoseconds>(left - seconds).count())};
+    int signal = sigtimedwait(&set, nullptr, &timeout);
+    if (stop_)
+      return;
+    if (signal == SIGTERM && terminated_) {
+      // The second SIGTERM terminates the process.
+      std::signal(SIGTERM, SIG_DFL);
+      pthread_sigmask(SIG_UNBLOCK, &set, nullptr);
+      raise(SIGTERM);
+    } else if (signal == SIGTERM) {
+      Write();
+      terminated_ = true;
+    } else if (std::chrono::steady_clock::now() >= next) {
+      // Without a new state to write, asks the search for one.
+      if (!path_.empty() && !Write())
+        stale_ = true;
+      next = std::chrono::steady_clock::now() + interval_;
+    }
+  }
+}
+
+bool CheckpointWriter::Write() {
+  Checkpoint checkpoint;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (path_.empty() || updates_ == written_)
+      return false;
+    checkpoint = latest_;
+    written_ = updates_;
+  }
+  if (!SaveCheckpoint(path_, checkpoint))
+    std::cerr << "Failed to write the checkpoint '" << path_ << "'\n";
+  return true;
+}
+
+}  // namespace kopt
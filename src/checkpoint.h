@@ -0,0 +1,91 @@
+#ifndef KOPT_SRC_CHECKPOINT_H_
+#define KOPT_SRC_CHECKPOINT_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace kopt {
+
+// The state of an iterated local search (--iterate), from which it can be resumed. Checkpoints are small text files:
+// a version line followed by one "KEY value" line per field, with the tour last.
+struct Checkpoint {
+  int n = 0;
+  // The checksum of the input (see Checksum), to refuse resuming on another instance of the same size.
+  std::uint64_t input_checksum = 0;
+  // The --algorithm and the number of signatures it tries, to refuse resuming with a different configuration.
+  std::string algorithm;
+  int signature_count = 0;
+  // The other flags that change the signatures or their moves, for the same reason.
+  bool shuffle_signatures = false;
+  bool sparse_tables = false;
+  int candidates = 0;
+  bool quadrant_candidates = false;
+  // The index of the signature to try next.
+  int cursor = 0;
+  // The wall time used so far and the current deadline, in clock() ticks.
+  std::int64_t clock = 0, deadline = 0;
+  // The state of Rng() before the signatures were prepared, as written by operator<<, so that --shuffle_signatures
+  // orders them the same way again.
+  std::string rng;
+  // The current cycle, by original ids.
+  std::vector<int> tour;
+};
+
+// Writes the checkpoint under a temporary name, flushes it to the disk and renames it, then flushes the directory, so
+// that neither a crash of the process nor of the system leaves a partial file. Returns false if the file cannot be
+// written.
+bool SaveCheckpoint(const std::string &path, const Checkpoint &);
+// Returns false and sets *error if the file cannot be read or is malformed.
+bool LoadCheckpoint(const std::string &path, Checkpoint *, std::string *error);
+
+// Blocks SIGTERM in the calling thread and in the threads it starts afterwards, so that only a CheckpointWriter
+// receives it. Must be called before any other thread is started.
+void BlockTermination();
+
+// Writes the checkpoints of a search from a thread of its own, which waits for SIGTERM with sigtimedwait, so that
+// neither the periodic checkpoints nor the one written on SIGTERM wait for the search to finish its current step. The
+// search hands over a copy of its state whenever it changes, and the thread writes the latest copy every interval if
+// it changed, and right away on SIGTERM. A second SIGTERM terminates the process as usual. SIGTERM must be blocked in
+// every thread, see BlockTermination.
+class CheckpointWriter {
+ public:
+  // Without a path, the thread only waits for SIGTERM.
+  CheckpointWriter(std::string path, std::chrono::seconds interval);
+  CheckpointWriter(const CheckpointWriter &) = delete;
+  CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+  ~CheckpointWriter();
+
+  // Replaces the state to write. An empty tour keeps the last one, so that the search only copies its tour when it
+  // changes.
+  void Update(Checkpoint);
+  // Whether SIGTERM arrived, after which the search should stop at its next step.
+  bool Terminated() const { return terminated_; }
+  // Whether an interval passed without an update, for a search which defers the updates while they are costly.
+  bool Stale() const { return stale_; }
+  // Stops the thread and writes the final state.
+  void Finish(const Checkpoint &);
+
+ private:
+  void Run();
+  // Writes the latest state if it changed since the last write. Returns false if it did not change.
+  bool Write();
+  void Stop();
+
+  std::string path_;
+  std::chrono::seconds interval_;
+  std::mutex mutex_;
+  Checkpoint latest_;
+  // The number of updates so far, and the number of them the last write included.
+  std::uint64_t updates_ = 0, written_ = 0;
+  std::atomic<bool> terminated_{false}, stale_{false}, stop_{false};
+  std::thread thread_;
+};
+
+}  // namespace kopt
+
+#endif  // KOPT_SRC_CHECKPOINT_H_
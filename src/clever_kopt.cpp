@@ -3,6 +3,7 @@
 #include <iostream>
 
 #include <dynamic.h>
+#include <gain_bound.h>
 #include <matching.h>
 #include <retrieve_solution.h>
 #include <naive_kopt.h>
@@ -35,41 +36,35 @@ static std::vector<Sig> Signatures(int n, const DecompositionLibrary &library, i
 }
 
 static std::vector<CycleNode> Kopt(
-    const Graph &graph, const std::vector<Sig> &signatures, bool dynamic, bool first_better, clock_t deadline) {
+    const Graph &graph, const std::vector<Sig> &signatures, bool dynamic, bool first_better, clock_t deadline,
+    std::shared_ptr<const NeighborLists> candidates = nullptr, bool lean_tables = false) {
+  std::shared_ptr<const CandidateGraph> candidate_graph;
+  if (candidates)
+    candidate_graph = std::make_shared<const CandidateGraph>(graph, *candidates);
+  GainBound bound(graph);
   int64_t best_gain = 0;
   Matching best_matching;
   std::unique_ptr<EmbeddingInterface> best_embedding;
   for (auto &sig : signatures) {
     if (deadline && clock() >= deadline) break;
+    if (bound.Hopeless(sig.id)) continue;
     Matching matching(sig.id);
-    GainFunc gain_func(graph, matching);
     if (dynamic) {
-      auto result = sig.decomposition->Dfs(Dynamic(graph.N(), gain_func));
-      if (result->table[0] > best_gain) {
-        best_gain = result->table[0];
+      auto move = DynamicKopt(*sig.decomposition, sig.id, graph, candidate_graph, lean_tables, best_gain);
+      if (move.gain > best_gain) {
+        best_gain = move.gain;
         best_matching = matching;
-        best_embedding = std::make_unique<SlowEmbedding>(RetrieveEmbedding(result, graph.N()));
+        best_embedding = std::make_unique<SlowEmbedding>(move.embedding);
         if (first_better) break;
       }
     } else {
-      Embedding embedding(Len(sig.id) + 1, graph.N());
-      do {
-        // Hacky, but fast.
-        int64_t gain = 0;
-        int k = embedding.Domain().Size();
-        for (int i = 0; i < k; ++i) gain += graph.GetWeight(embedding(SigEdge(i)));
-        for (int i = 0; i < 2*k; ++i) {
-          SigNode x(i), y = matching(x);
-          if (x.id < y.id) gain -= graph.GetWeight(embedding.FastMapNode(x.id), embedding.FastMapNode(y.id));
-        }
-        // End hack.
-        if (gain > best_gain) {
-          best_gain = gain;
-          best_matching = matching;
-          best_embedding = std::make_unique<Embedding>(embedding);
-          if (first_better) break;
-        }
-      } while (embedding.Next());
+      auto move = SignatureKopt(sig.id, graph, first_better);
+      if (move.gain > best_gain) {
+        best_gain = move.gain;
+        best_matching = matching;
+        best_embedding = std::make_unique<SlowEmbedding>(move.embedding);
+        if (first_better) break;
+      }
     }
   }
   if (best_gain > 0)
@@ -78,8 +73,9 @@ static std::vector<CycleNode> Kopt(
     return IdentityCycle(graph.N());
 }
 
-std::vector<CycleNode> LocalClever(int k, const Graph &graph, const DecompositionLibrary &library) {
-  return Kopt(graph, Signatures(graph.N(), library, k, k), true, false, 0);
+std::vector<CycleNode> LocalClever(int k, const Graph &graph, const DecompositionLibrary &library,
+                                   std::shared_ptr<const NeighborLists> candidates, bool lean_tables) {
+  return Kopt(graph, Signatures(graph.N(), library, k, k), true, false, 0, std::move(candidates), lean_tables);
 }
 
 std::vector<CycleNode> LocalNaive(int k, const Graph &graph, const DecompositionLibrary &library) {
@@ -92,7 +88,7 @@ static void PrintWeight(int64_t weight) {
 
 std::vector<CycleNode> Global(Graph *graph, const DecompositionLibrary &library) {
   auto signatures = Signatures(graph->N(), library, 4, 7, 2);
-  int64_t weight = graph->CycleWeight(IdentityCycle(graph->N()));
+  int64_t weight = graph->TourWeight();
   PrintWeight(weight);
 
   clock_t deadline = clock() + 30 * CLOCKS_PER_SEC;
@@ -1,15 +1,20 @@
 #ifndef KOPT_CLEVER_CLEVER_KOPT_H_
 #define KOPT_CLEVER_CLEVER_KOPT_H_
 
+#include <memory>
 #include <vector>
 
 #include <decomposition_library.h>
 #include <graph.h>
 #include <identifier.h>
+#include "spatial_index.h"
 
 namespace kopt {
 
-std::vector<CycleNode> LocalClever(int k, const Graph &, const DecompositionLibrary &);
+// With candidate neighbor lists, uses the sparse mode of Dynamic, which only finds moves whose added edges join
+// candidate neighbors. With lean_tables, uses its lean mode.
+std::vector<CycleNode> LocalClever(int k, const Graph &, const DecompositionLibrary &,
+                                   std::shared_ptr<const NeighborLists> candidates = nullptr, bool lean_tables = false);
 std::vector<CycleNode> LocalNaive(int k, const Graph &, const DecompositionLibrary &);
 std::vector<CycleNode> Global(Graph *, const DecompositionLibrary &);
 
@@ -0,0 +1,225 @@
+#include "construction.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "spatial_index.h"
+
+namespace kopt {
+namespace {
+
+// The Hilbert curve fills a grid of 2^kHilbertOrder x 2^kHilbertOrder cells.
+constexpr int kHilbertOrder = 16;
+
+// The index of the cell (x, y) along the Hilbert curve.
+std::uint64_t HilbertIndex(std::uint32_t x, std::uint32_t y) {
+  constexpr std::uint32_t side = 1u << kHilbertOrder;
+  std::uint64_t index = 0;
+  for (std::uint32_t s = side / 2; s > 0; s /= 2) {
+    std::uint32_t rx = (x & s) > 0, ry = (y & s) > 0;
+    index += std::uint64_t(s) * s * ((3 * rx) ^ ry);
+    // Rotates the quadrant so that the curve inside it has the orientation of the whole curve.
+    if (ry == 0) {
+      if (rx == 1) {
+        x = side - 1 - x;
+        y = side - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return index;
+}
+
+class UnionFind {
+ public:
+  explicit UnionFind(int n) : parent_(Sequence(n)) {}
+
+  int Find(int v) {
+    while (parent_[v] != v)
+      v = parent_[v] = parent_[parent_[v]];
+    return v;
+  }
+  // Returns false if u and v were already in the same set.
+  bool Union(int u, int v) {
+    u = Find(u);
+    v = Find(v);
+    if (u == v)
+      return false;
+    parent_[u] = v;
+    return true;
+  }
+
+ private:
+  std::vector<int> parent_;
+};
+
+// The pairs of positions (u, v) with u < v that are candidate neighbors.
+std::vector<std::pair<int, int>> CandidatePairs(const Graph &graph, const NeighborLists &neighbors) {
+  int n = graph.N();
+  assert(neighbors.N() == n);
+  auto &perm = graph.GetPermutation();
+  std::vector<int> position(n);
+  for (int v = 0; v < n; ++v)
+    position[perm[v]] = v;
+  std::vector<std::pair<int, int>> pairs;
+  for (int u = 0; u < n; ++u) {
+    for (int i = 0; i < neighbors.K(); ++i) {
+      int v = position[neighbors[perm[u]][i]];
+      pairs.emplace_back(std::min(u, v), std::max(u, v));
+    }
+  }
+  std::sort(pairs.begin(), pairs.end());
+  pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+  return pairs;
+}
+
+// The neighbors of every node on the paths built by GreedyPaths, -1 where there is none.
+using PathLinks = std::vector<std::array<int, 2>>;
+
+// Adds the edges in the given order, skipping those which would give a node degree 3 or close a cycle.
+PathLinks GreedyPaths(int n, const std::vector<std::pair<int, int>> &edges) {
+  PathLinks links(n, {-1, -1});
+  UnionFind components(n);
+  for (auto [u, v] : edges) {
+    if (links[u][1] >= 0 || links[v][1] >= 0 || !components.Union(u, v))
+      continue;
+    links[u][links[u][0] >= 0] = v;
+    links[v][links[v][0] >= 0] = u;
+  }
+  return links;
+}
+
+// Builds a cycle from the paths: starting with the path that ends at start, repeatedly follows a path and moves on to
+// the nearest end of a path which was not visited yet.
+Permutation LinkPaths(const Graph &graph, const PathLinks &links, int start) {
+  int n = graph.N();
+  auto is_end = [&links](int v) { return links[v][1] < 0; };
+  assert(is_end(start));
+  // The ends of the paths which were not visited yet, in a KdTree or, for graphs without coordinates, in a list.
+  std::unique_ptr<KdTree> tree;
+  std::vector<int> ends;
+  std::vector<bool> visited(n);
+  if (graph.HasCoordinates()) {
+    tree = std::make_unique<KdTree>(graph);
+    for (int v = 0; v < n; ++v)
+      if (!is_end(v)) tree->Remove(v);
+  } else {
+    for (int v = 0; v < n; ++v)
+      if (is_end(v)) ends.emplace_back(v);
+  }
+
+  std::vector<int> order, nearest;
+  order.reserve(n);
+  int at = start;
+  while (true) {
+    int prev = -1, v = at;
+    while (true) {
+      order.emplace_back(v);
+      visited[v] = true;
+      int next = links[v][0] == prev ? links[v][1] : links[v][0];
+      if (next < 0)
+        break;
+      prev = v;
+      v = next;
+    }
+    if (Size(order) == n)
+      break;
+    if (tree) {
+      tree->Remove(at);
+      tree->Remove(v);
+      tree->Nearest(graph[v], 1, &nearest);
+      at = nearest[0];
+    } else {
+      at = -1;
+      for (int end : ends)
+        if (!visited[end] && (at < 0 || graph(v, end) < graph(v, at)))
+          at = end;
+    }
+  }
+  return Permutation(std::move(order));
+}
+
+}  // namespace
+
+Permutation SpaceFillingCurveTour(const Graph &graph) {
+  assert(graph.HasCoordinates());
+  int n = graph.N();
+  if (n == 0)
+    return Permutation(0);
+  double min_x = graph[0].x, max_x = min_x, min_y = graph[0].y, max_y = min_y;
+  for (int v = 1; v < n; ++v) {
+    min_x = std::min(min_x, graph[v].x);
+    max_x = std::max(max_x, graph[v].x);
+    min_y = std::min(min_y, graph[v].y);
+    max_y = std::max(max_y, graph[v].y);
+  }
+  // Both coordinates are scaled by the same factor, so that the curve follows the shape of the instance.
+  double extent = std::max(max_x - min_x, max_y - min_y);
+  double scale = extent > 0 ? ((1u << kHilbertOrder) - 1) / extent : 0;
+  std::vector<std::pair<std::uint64_t, int>> keys(n);
+  for (int v = 0; v < n; ++v) {
+    auto x = static_cast<std::uint32_t>((graph[v].x - min_x) * scale);
+    auto y = static_cast<std::uint32_t>((graph[v].y - min_y) * scale);
+    keys[v] = {HilbertIndex(x, y), v};
+  }
+  std::sort(keys.begin(), keys.end());
+  std::vector<int> order(n);
+  for (int i = 0; i < n; ++i)
+    order[i] = keys[i].second;
+  return Permutation(std::move(order));
+}
+
+Permutation GreedyEdgeTour(const Graph &graph, const NeighborLists &neighbors) {
+  int n = graph.N();
+  if (n == 0)
+    return Permutation(0);
+  auto pairs = CandidatePairs(graph, neighbors);
+  std::vector<std::pair<Weight, std::pair<int, int>>> edges;
+  edges.reserve(pairs.size());
+  for (auto [u, v] : pairs)
+    edges.emplace_back(graph(u, v), std::make_pair(u, v));
+  std::sort(edges.begin(), edges.end());
+  pairs.clear();
+  for (auto &edge : edges)
+    pairs.emplace_back(edge.second);
+  auto links = GreedyPaths(n, pairs);
+  int start = 0;
+  while (links[start][1] >= 0) ++start;
+  return LinkPaths(graph, links, start);
+}
+
+Permutation SavingsTour(const Graph &graph, const NeighborLists &neighbors) {
+  int n = graph.N();
+  if (n == 0)
+    return Permutation(0);
+  int hub = 0;
+  if (graph.HasCoordinates()) {
+    Point center{0, 0};
+    for (int v = 0; v < n; ++v) {
+      center.x += graph[v].x / n;
+      center.y += graph[v].y / n;
+    }
+    std::vector<int> nearest;
+    KdTree(graph).Nearest(center, 1, &nearest);
+    hub = nearest[0];
+  }
+  std::vector<std::pair<Weight, std::pair<int, int>>> edges;
+  for (auto [u, v] : CandidatePairs(graph, neighbors))
+    if (u != hub && v != hub)
+      edges.emplace_back(graph(u, v) - graph(hub, u) - graph(hub, v), std::make_pair(u, v));
+  // By decreasing savings.
+  std::sort(edges.begin(), edges.end());
+  std::vector<std::pair<int, int>> pairs;
+  pairs.reserve(edges.size());
+  for (auto &edge : edges)
+    pairs.emplace_back(edge.second);
+  // The hub stays isolated, so that the walk through the paths starts and ends there.
+  return LinkPaths(graph, GreedyPaths(n, pairs), hub);
+}
+
+}  // namespace kopt
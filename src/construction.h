@@ -0,0 +1,29 @@
+#ifndef KOPT_SRC_CONSTRUCTION_H_
+#define KOPT_SRC_CONSTRUCTION_H_
+
+#include "graph.h"
+#include "permutation.h"
+#include "spatial_index.h"
+
+namespace kopt {
+
+// Constructive heuristics for the initial cycle. Each returns the current positions of the graph in the order of the
+// new cycle, to be passed to Graph::Permutate, and runs in O(n log n) time on graphs with coordinates.
+
+// Visits the nodes in the order of the Hilbert curve through the bounding box of the coordinates. The graph must have
+// coordinates.
+Permutation SpaceFillingCurveTour(const Graph &);
+
+// The greedy edge heuristic: adds the edges between candidate neighbors from the lightest on, skipping those which
+// would give a node degree 3 or close a cycle, and then links the resulting paths by joining the end of the path built
+// so far to the nearest end of another path. The candidate neighbors are those of the lists, by original ids.
+Permutation GreedyEdgeTour(const Graph &, const NeighborLists &);
+
+// The Clarke-Wright savings heuristic: with the node nearest to the center as the hub, adds the edges (u, v) between
+// candidate neighbors by decreasing savings d(hub, u) + d(hub, v) - d(u, v) under the rules of GreedyEdgeTour, and
+// links the paths into a cycle through the hub.
+Permutation SavingsTour(const Graph &, const NeighborLists &);
+
+}  // namespace kopt
+
+#endif  // KOPT_SRC_CONSTRUCTION_H_
@@ -4,6 +4,7 @@
 
 #include <common.h>
 #include <matching.h>
+#include "gain_bound.h"
 #include "slow_embedding.h"
 #include "retrieve_solution.h"
 
@@ -53,7 +54,7 @@ struct FasterSubset {
   FasterSubset(int k, const Graph &graph) : subset(k, graph.N()), permutation(graph.N()), now(k) {
     std::vector<Edge> edges(graph.N());
     for (int i = 0; i < graph.N(); ++i)
-      edges[i] = Edge{graph(i, i + 1), i};
+      edges[i] = Edge{graph.EdgeWeight(i), i};
     std::sort(edges.begin(), edges.end());
     for (int i = 0; i < graph.N(); ++i)
       permutation[i] = edges[i].idx;
@@ -96,9 +97,10 @@ struct Dynamic {
   struct Edge {
     int i, x, y;
 
-    int64_t Gain(const Graph &graph, int i = -1) const {
+    template<class G>
+    int64_t Gain(const G &graph, int i = -1) const {
       if (i == -1) i = this->i;
-      return graph(i, i + 1) - graph(i, x) - graph(i + 1, y);
+      return graph.EdgeWeight(i) - graph(i, x) - graph(i + 1, y);
     }
 
     friend std::ostream &operator<<(std::ostream &stream, const Dynamic::Edge edge) {
@@ -113,7 +115,8 @@ struct Dynamic {
     return Size(edges) <= end - begin;
   }
 
-  void Run(const Graph &graph, DynamicTable *t) {
+  template<class G>
+  void Run(const G &graph, DynamicTable *t) {
     int n = end - begin, m = Size(edges);
     for (int i = 0; i < n; ++i) {
       for (int j = std::min(i, m - 1); j >= 0; --j) {
@@ -211,7 +214,8 @@ struct DeBergSignature {
       }
   }
 
-  int64_t Embed(const Graph &graph, FastSubset *result) {
+  template<class G>
+  int64_t Embed(const G &graph, FastSubset *result) {
     int64_t best_gain = 0;
     DynamicTable table(graph.N(), DynSize());
     FastSubset subset(Size(del), graph.N());
@@ -240,10 +244,11 @@ struct DeBergSignature {
     return exp;
   }
 
-  int64_t Gain(const Graph &graph, const FastSubset &subset) const {
+  template<class G>
+  int64_t Gain(const G &graph, const FastSubset &subset) const {
     int64_t gain = 0;
     for (int i = 0; i < Size(del); ++i)
-      gain += graph(subset[i], subset[i] + 1);
+      gain += graph.EdgeWeight(subset[i]);
     for (auto &edge : add)
       gain -= graph(subset.MapNode(edge.x), subset.MapNode(edge.y));
     for (auto &dynamic : dyn) {
@@ -281,8 +286,11 @@ std::ostream &operator<<(std::ostream &stream, const DeBergSignature &sig) {
   return stream;
 }
 
+// G is a view of the graph, see Graph::Visit.
+template<class G>
 std::vector<CycleNode> GenericDeBerg(std::vector<DeBergSignature> *signatures,
-                                  const Graph &graph,
+                                  const G &graph,
+                                  const GainBound &bound,
                                   bool first_better = false,
                                   clock_t deadline = 0) {
   int64_t best_gain = 0;
@@ -292,6 +300,7 @@ std::vector<CycleNode> GenericDeBerg(std::vector<DeBergSignature> *signatures,
   FastSubset subset;
   for (auto &sig : *signatures) {
     if (deadline && clock() > deadline) break;
+    if (bound.Hopeless(sig.matching.Id())) continue;
     int64_t gain = sig.Embed(graph, &subset);
     if (gain > best_gain) {
       best_gain = gain;
@@ -330,7 +339,8 @@ std::vector<DeBergSignature> GenerateDeBergSignatures(int min_k, int max_k) {
 
 std::vector<CycleNode> LocalDeBerg(int k, const Graph &graph) {
   auto signatures = GenerateDeBergSignatures(k, k);
-  return GenericDeBerg(&signatures, graph);
+  GainBound bound(graph);
+  return graph.Visit([&](const auto &view) { return GenericDeBerg(&signatures, view, bound); });
 }
 
 static void PrintWeight(int64_t weight) {
@@ -339,14 +349,19 @@ static void PrintWeight(int64_t weight) {
 
 std::vector<CycleNode> GlobalDeBerg(int k, Graph *graph) {
   auto signatures = GenerateDeBergSignatures(2, k);
-  int64_t weight = graph->CycleWeight(IdentityCycle(graph->N()));
+  int64_t weight = graph->TourWeight();
   PrintWeight(weight);
+  GainBound bound(*graph);
   while (true) {
-    std::vector<CycleNode> solution = GenericDeBerg(&signatures, *graph, true, clock() + 30 * CLOCKS_PER_SEC);
+    clock_t deadline = clock() + 30 * CLOCKS_PER_SEC;
+    std::vector<CycleNode> solution = graph->Visit([&signatures, &bound, deadline](const auto &view) {
+      return GenericDeBerg(&signatures, view, bound, true, deadline);
+    });
     auto new_weight = graph->CycleWeight(solution);
     if (new_weight < weight) {
       PrintWeight(weight = new_weight);
       graph->ApplyPermutation(solution);
+      bound.Update(*graph);
     } else {
       break;
     }
@@ -363,7 +378,7 @@ int DeBergExponent(MatchingId m) {
 Kmove SingleDeBerg(MatchingId m, const Graph &g) {
   DeBergSignature sig((Matching(m)));
   FastSubset result;
-  int64_t gain = sig.Embed(g, &result);
+  int64_t gain = g.Visit([&sig, &result](const auto &view) { return sig.Embed(view, &result); });
   if (gain > 0) {
     SlowEmbedding e;
     for (int i = 0; i < result.k; ++i)
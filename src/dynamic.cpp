@@ -1,6 +1,11 @@
 #include <dynamic.h>
 
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
 #include <fast_embedding.h>
+#include <gain_func.h>
 
 namespace kopt {
 namespace {
@@ -17,14 +22,93 @@ Dynamic::Result DynamicResult(Dynamic::Bag &bag, Dynamic::Table &table) {
   return std::make_unique<Dynamic::ResultStruct>(bag, std::move(table), nullptr, nullptr);
 }
 
+bool IsIntroduce(const Dynamic::ResultStruct &node) {
+  return node.left && !node.right && node.bag.Size() > node.left->bag.Size();
+}
+
+// An embedding of a bag whose values are stored in an Entry of a sparse table.
+class EntryEmbedding : public EmbeddingInterface {
+ public:
+  EntryEmbedding(Set<SigEdge> domain, const Dynamic::Table::Entry *entry) : domain_(domain), entry_(entry) {}
+
+  Set<SigEdge> Domain() const override { return domain_; }
+
+ private:
+  Set<SigEdge> domain_;
+  const Dynamic::Table::Entry *entry_;
+
+  CycleEdge MapEdge(SigEdge edge) const override { return CycleEdge(entry_->values[domain_.Index(edge)]); }
+};
+
 }  // namespace
 
+CandidateGraph::CandidateGraph(const Graph &graph, const NeighborLists &neighbors) : offsets_(graph.N() + 1) {
+  int n = graph.N();
+  assert(neighbors.N() == n);
+  auto &perm = graph.GetPermutation();
+  std::vector<int> position(n);
+  for (int v = 0; v < n; ++v)
+    position[perm[v]] = v;
+  std::vector<std::pair<int, int>> pairs;
+  pairs.reserve(2 * std::size_t(n) * neighbors.K());
+  for (int u = 0; u < n; ++u) {
+    for (int i = 0; i < neighbors.K(); ++i) {
+      int v = position[neighbors[perm[u]][i]];
+      pairs.emplace_back(u, v);
+      pairs.emplace_back(v, u);
+    }
+  }
+  std::sort(pairs.begin(), pairs.end());
+  pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+  adjacent_.reserve(pairs.size());
+  for (auto &pair : pairs) {
+    ++offsets_[pair.first + 1];
+    adjacent_.emplace_back(pair.second);
+  }
+  for (int u = 0; u < n; ++u)
+    offsets_[u + 1] += offsets_[u];
+}
+
+bool CandidateGraph::Adjacent(int u, int v) const {
+  return std::binary_search((*this)[u], (*this)[u] + Degree(u), v);
+}
+
 static const int64_t kNone = std::numeric_limits<int64_t>::min();
 
 Dynamic::Table::Table(Set<SigEdge> bag, int graph_size)
     : table_(Embedding::IdSize(bag, graph_size), kNone),
       bag_(bag), graph_size_(graph_size) {}
 
+Dynamic::Table::Table(Set<SigEdge> bag, int graph_size, std::vector<Entry> entries)
+    : sparse_(true), entries_(std::move(entries)), bag_(bag), graph_size_(graph_size) {
+  assert(bag.Size() <= kMaxBag);
+}
+
+Dynamic::Table Dynamic::Table::Deferred(Set<SigEdge> bag, int graph_size) {
+  Table table(bag, graph_size, {});
+  table.sparse_ = false;
+  table.released_ = true;
+  return table;
+}
+
+void Dynamic::Table::Release() {
+  std::vector<int64_t>().swap(table_);
+  std::vector<Entry>().swap(entries_);
+  released_ = true;
+}
+
+int64_t Dynamic::Table::At(const SlowEmbedding &embedding) const {
+  assert(!released_);
+  if (!sparse_)
+    return table_[embedding.Index()];
+  Entry entry;
+  int i = 0;
+  for (auto edge : bag_)
+    entry.values[i++] = embedding(edge).id;
+  auto it = std::lower_bound(entries_.begin(), entries_.end(), entry);
+  return it != entries_.end() && it->values == entry.values ? it->gain : kNone;
+}
+
 template<class Index>
 int64_t& Dynamic::Table::operator[](const Index &idx) {
   return table_[idx.Id()];
@@ -47,17 +131,133 @@ struct Clock {
   clock_t start;
 };
 
-Dynamic::Dynamic(int graph_size, GainFunc gain) : graph_size_(graph_size), gain_(gain) {}
+namespace {
+
+// The operations of the dynamic program, computing the gains on the view G of the graph. The visitor of
+// Decomposition::Dfs in DynamicKopt.
+template<class G>
+class DynamicProgram : public Dynamic {
+ public:
+  DynamicProgram(int graph_size, GainFunc<G> gain, std::shared_ptr<const CandidateGraph> candidates, bool lean)
+      : graph_size_(graph_size), gain_(gain), candidates_(std::move(candidates)), lean_(lean) {}
+
+  Result Leaf() const;
+  Result Introduce(SigEdge introduced, Result child) const;
+  Result Forget(SigEdge forgotten, Result child) const;
+  Result Join(Result left, Result right) const;
+  // Computes the released table of the node again from its children, recomputing their released tables first.
+  void Recompute(ResultStruct *node) const;
+  // A copy which keeps the tables it recomputes, for the retrieval: the forgotten edges below read them again.
+  DynamicProgram Keeping() const;
+  // Whether the node is an Introduce node whose table is deferred, in the lean exact mode.
+  bool Deferred(const ResultStruct &node) const;
+  // The gain of the embedding of the bag of the node, reading through the deferred tables of Introduce nodes.
+  int64_t At(const ResultStruct &node, const SlowEmbedding &embedding) const;
+
+ private:
+  Result ExactIntroduce(SigEdge introduced, Result child) const;
+  // Forgets an edge of an Introduce node whose table was deferred, from the table of its child.
+  Result ForgetDeferred(SigEdge forgotten, Result child) const;
+  Result SparseIntroduce(SigEdge introduced, Result child) const;
+  Result SparseForget(SigEdge forgotten, Result child) const;
+  Result SparseJoin(Result left, Result right) const;
+  // Recomputes the table of the node if it was released.
+  void Ready(const Result &node) const;
+  // Releases the table of the child of a new node in the lean mode, unless it is a checkpoint.
+  void Release(const Result &child) const;
+  // The position of the left or right endpoint of the cycle edge.
+  int Endpoint(int edge, bool left) const { return left ? edge : edge + 1 < graph_size_ ? edge + 1 : 0; }
+
+  const int graph_size_;
+  const GainFunc<G> gain_;
+  const std::shared_ptr<const CandidateGraph> candidates_;  // Null in the exact mode.
+  const bool lean_;
+  bool keep_ = false;
+};
+
+template<class G>
+DynamicProgram<G> DynamicProgram<G>::Keeping() const {
+  DynamicProgram keeping = *this;
+  keeping.keep_ = true;
+  return keeping;
+}
+
+template<class G>
+void DynamicProgram<G>::Release(const Result &child) const {
+  if (lean_ && !keep_ && !child->right)
+    child->table.Release();
+}
+
+template<class G>
+void DynamicProgram<G>::Ready(const Result &node) const {
+  if (node->table.Released())
+    Recompute(node.get());
+}
+
+template<class G>
+void DynamicProgram<G>::Recompute(ResultStruct *node) const {
+  assert(node->table.Released());
+  Result rebuilt;
+  if (!node->left) {
+    rebuilt = Leaf();
+  } else if (node->right) {
+    rebuilt = Join(std::move(node->left), std::move(node->right));
+  } else if (IsIntroduce(*node)) {
+    SigEdge introduced = *(node->bag - node->left->bag).begin();
+    Ready(node->left);
+    rebuilt = candidates_ ? SparseIntroduce(introduced, std::move(node->left))
+                          : ExactIntroduce(introduced, std::move(node->left));
+  } else {
+    SigEdge forgotten = *(node->left->bag - node->bag).begin();
+    rebuilt = Forget(forgotten, std::move(node->left));
+  }
+  *node = std::move(*rebuilt);
+}
+
+template<class G>
+bool DynamicProgram<G>::Deferred(const ResultStruct &node) const {
+  return !candidates_ && node.table.Released() && IsIntroduce(node);
+}
+
+template<class G>
+int64_t DynamicProgram<G>::At(const ResultStruct &node, const SlowEmbedding &embedding) const {
+  if (!Deferred(node))
+    return node.table.At(embedding);
+  SigEdge introduced = *(node.bag - node.left->bag).begin();
+  SlowEmbedding child_embedding = embedding;
+  child_embedding.Remove(introduced);
+  int64_t child_gain = At(*node.left, child_embedding);
+  return child_gain != kNone ? child_gain + gain_.Introduce(embedding, introduced) : kNone;
+}
 
-Dynamic::Result Dynamic::Leaf() const {
+template<class G>
+Dynamic::Result DynamicProgram<G>::Leaf() const {
   auto bag = Set<SigEdge>();
+  if (candidates_) {
+    auto table = Table(bag, graph_size_, {Table::Entry{{}, 0}});
+    return DynamicResult(bag, table);
+  }
   auto table = Table(bag, graph_size_);
   auto embedding = Embedding(bag, graph_size_);
   table[embedding] = 0;
   return DynamicResult(bag, table);
 }
 
-Dynamic::Result Dynamic::Introduce(SigEdge introduced, Result child) const {
+template<class G>
+Dynamic::Result DynamicProgram<G>::Introduce(SigEdge introduced, Result child) const {
+  Ready(child);
+  if (candidates_)
+    return SparseIntroduce(introduced, std::move(child));
+  if (lean_) {
+    auto parent_bag = child->bag + Bag(introduced);
+    auto parent_table = Table::Deferred(parent_bag, graph_size_);
+    return DynamicResult(parent_bag, parent_table, child);
+  }
+  return ExactIntroduce(introduced, std::move(child));
+}
+
+template<class G>
+Dynamic::Result DynamicProgram<G>::ExactIntroduce(SigEdge introduced, Result child) const {
   auto parent_bag = child->bag + Bag(introduced);
   auto parent_table = Table(parent_bag, graph_size_);
   auto parent_embedding = Embedding(parent_bag, graph_size_);
@@ -68,10 +268,17 @@ Dynamic::Result Dynamic::Introduce(SigEdge introduced, Result child) const {
       parent_gain = child_gain + gain_.Introduce(parent_embedding, introduced);
     }
   } while (parent_embedding.Next());
+  Release(child);
   return DynamicResult(parent_bag, parent_table, child);
 }
 
-Dynamic::Result Dynamic::Forget(SigEdge forgotten, Result child) const {
+template<class G>
+Dynamic::Result DynamicProgram<G>::Forget(SigEdge forgotten, Result child) const {
+  if (Deferred(*child))
+    return ForgetDeferred(forgotten, std::move(child));
+  Ready(child);
+  if (candidates_)
+    return SparseForget(forgotten, std::move(child));
   auto parent_bag = child->bag - Bag(forgotten);
   auto parent_table = Table(parent_bag, graph_size_);
   auto child_embedding = Embedding(child->bag, graph_size_);
@@ -80,10 +287,35 @@ Dynamic::Result Dynamic::Forget(SigEdge forgotten, Result child) const {
     auto &child_gain = child->table[child_embedding];
     parent_gain = std::max(parent_gain, child_gain);
   } while (child_embedding.Next());
+  Release(child);
   return DynamicResult(parent_bag, parent_table, child);
 }
 
-Dynamic::Result Dynamic::Join(Result left, Result right) const {
+template<class G>
+Dynamic::Result DynamicProgram<G>::ForgetDeferred(SigEdge forgotten, Result child) const {
+  auto &grandchild = child->left;
+  Ready(grandchild);
+  SigEdge introduced = *(child->bag - grandchild->bag).begin();
+  auto parent_bag = child->bag - Bag(forgotten);
+  auto parent_table = Table(parent_bag, graph_size_);
+  auto child_embedding = Embedding(child->bag, graph_size_);
+  do {
+    auto &grandchild_gain = grandchild->table[child_embedding - introduced];
+    if (grandchild_gain != kNone) {
+      auto &parent_gain = parent_table[child_embedding - forgotten];
+      parent_gain = std::max(parent_gain, grandchild_gain + gain_.Introduce(child_embedding, introduced));
+    }
+  } while (child_embedding.Next());
+  Release(grandchild);
+  return DynamicResult(parent_bag, parent_table, child);
+}
+
+template<class G>
+Dynamic::Result DynamicProgram<G>::Join(Result left, Result right) const {
+  Ready(left);
+  Ready(right);
+  if (candidates_)
+    return SparseJoin(std::move(left), std::move(right));
   auto parent_bag = left->bag;
   auto parent_table = Table(left->bag, graph_size_);
   auto parent_embedding = Embedding(left->bag, graph_size_);
@@ -95,23 +327,151 @@ Dynamic::Result Dynamic::Join(Result left, Result right) const {
       parent_gain = left_gain + right_gain - gain_.Join(parent_embedding);
     }
   } while (parent_embedding.Next());
+  Release(left);
+  Release(right);
+  return DynamicResult(parent_bag, parent_table, left, right);
+}
+
+template<class G>
+Dynamic::Result DynamicProgram<G>::SparseIntroduce(SigEdge introduced, Result child) const {
+  auto parent_bag = child->bag + Bag(introduced);
+  int size = parent_bag.Size(), at = parent_bag.Index(introduced);
+  assert(size <= Table::kMaxBag);
+  // The added edges joining an endpoint of the introduced edge to an edge of the child bag. They restrict the value of
+  // the introduced edge to the candidate neighbors of the other endpoint.
+  struct Constraint {
+    bool left;  // The side of the endpoint of the introduced edge.
+    int index;  // The index of the other edge in the child bag.
+    bool other_left;
+  };
+  std::vector<Constraint> constraints;
+  for (SigNode x : {introduced.Left(), introduced.Right()}) {
+    SigNode y = gain_.GetMatching()(x);
+    if (y.Edge() != introduced && child->bag.Contains(y.Edge()))
+      constraints.emplace_back(Constraint{x.IsLeft(), child->bag.Index(y.Edge()), y.IsLeft()});
+  }
+
+  std::vector<Table::Entry> entries;
+  Table::Entry entry;
+  EntryEmbedding embedding(parent_bag, &entry);
+  auto add = [&](int value, int64_t child_gain) {
+    entry.values[at] = value;
+    entry.gain = child_gain + gain_.Introduce(embedding, introduced);
+    entries.emplace_back(entry);
+  };
+  for (auto &child_entry : child->table.Entries()) {
+    if (child_entry.gain == kNone)
+      continue;
+    for (int i = 0; i + 1 < size; ++i)
+      entry.values[i < at ? i : i + 1] = child_entry.values[i];
+    int lowest = at > 0 ? entry.values[at - 1] + 1 : 0;
+    int highest = at + 1 < size ? entry.values[at + 1] - 1 : graph_size_ - 1;
+    if (constraints.empty()) {
+      for (int value = lowest; value <= highest; ++value)
+        add(value, child_entry.gain);
+      continue;
+    }
+    auto &first = constraints[0];
+    int other = Endpoint(child_entry.values[first.index], first.other_left);
+    for (int i = 0; i < candidates_->Degree(other); ++i) {
+      int node = (*candidates_)[other][i];
+      int value = first.left ? node : (node > 0 ? node : graph_size_) - 1;
+      if (value < lowest || value > highest)
+        continue;
+      bool admissible = true;
+      for (int j = 1; j < Size(constraints); ++j) {
+        auto &constraint = constraints[j];
+        admissible = admissible && candidates_->Adjacent(Endpoint(value, constraint.left),
+                                                         Endpoint(child_entry.values[constraint.index],
+                                                                  constraint.other_left));
+      }
+      if (admissible)
+        add(value, child_entry.gain);
+    }
+  }
+  // The entries are already sorted if the introduced edge is the last one of the bag, except for wrapped values.
+  if (!std::is_sorted(entries.begin(), entries.end()))
+    std::sort(entries.begin(), entries.end());
+  auto parent_table = Table(parent_bag, graph_size_, std::move(entries));
+  Release(child);
+  return DynamicResult(parent_bag, parent_table, child);
+}
+
+template<class G>
+Dynamic::Result DynamicProgram<G>::SparseForget(SigEdge forgotten, Result child) const {
+  auto parent_bag = child->bag - Bag(forgotten);
+  int size = child->bag.Size(), at = child->bag.Index(forgotten);
+  std::vector<Table::Entry> entries;
+  for (auto entry : child->table.Entries()) {
+    std::copy(entry.values.begin() + at + 1, entry.values.begin() + size, entry.values.begin() + at);
+    entry.values[size - 1] = 0;
+    entries.emplace_back(entry);
+  }
+  if (!std::is_sorted(entries.begin(), entries.end()))
+    std::sort(entries.begin(), entries.end());
+  // Keeps the best gain of the entries with equal values.
+  int count = 0;
+  for (auto &entry : entries) {
+    if (count > 0 && entries[count - 1].values == entry.values)
+      entries[count - 1].gain = std::max(entries[count - 1].gain, entry.gain);
+    else
+      entries[count++] = entry;
+  }
+  entries.resize(count);
+  // The empty bag has a single embedding, which is not admissible if no embedding of the child bag is.
+  if (entries.empty() && parent_bag.Size() == 0)
+    entries.emplace_back(Table::Entry{{}, kNone});
+  auto parent_table = Table(parent_bag, graph_size_, std::move(entries));
+  Release(child);
+  return DynamicResult(parent_bag, parent_table, child);
+}
+
+template<class G>
+Dynamic::Result DynamicProgram<G>::SparseJoin(Result left, Result right) const {
+  auto parent_bag = left->bag;
+  std::vector<Table::Entry> entries;
+  auto &left_entries = left->table.Entries(), &right_entries = right->table.Entries();
+  Table::Entry entry;
+  EntryEmbedding embedding(parent_bag, &entry);
+  for (auto l = left_entries.begin(), r = right_entries.begin(); l != left_entries.end() && r != right_entries.end();) {
+    if (*l < *r) {
+      ++l;
+    } else if (*r < *l) {
+      ++r;
+    } else {
+      if (l->gain != kNone && r->gain != kNone) {
+        entry.values = l->values;
+        entry.gain = l->gain + r->gain - gain_.Join(embedding);
+        entries.emplace_back(entry);
+      }
+      ++l;
+      ++r;
+    }
+  }
+  if (entries.empty() && parent_bag.Size() == 0)
+    entries.emplace_back(Table::Entry{{}, kNone});
+  auto parent_table = Table(parent_bag, graph_size_, std::move(entries));
+  Release(left);
+  Release(right);
   return DynamicResult(parent_bag, parent_table, left, right);
 }
 
-void RetrieveEmbeddingDfs(const Dynamic::Result &subtree, SlowEmbedding *full, SlowEmbedding *bag) {
+template<class G>
+void RetrieveEmbeddingDfs(const Dynamic::Result &subtree, const DynamicProgram<G> &program, SlowEmbedding *full,
+                          SlowEmbedding *bag) {
   if (!subtree->left) {
     // Leaf
   } else if (subtree->right) {
     // Join
     SlowEmbedding bag_copy = *bag;
-    RetrieveEmbeddingDfs(subtree->left, full, bag);
+    RetrieveEmbeddingDfs(subtree->left, program, full, bag);
     *bag = bag_copy;
-    RetrieveEmbeddingDfs(subtree->right, full, bag);
+    RetrieveEmbeddingDfs(subtree->right, program, full, bag);
   } else if (subtree->bag.Size() > subtree->left->bag.Size()) {
     // Introduce
     SigEdge introduced = *(subtree->bag - subtree->left->bag).begin();
     bag->Remove(introduced);
-    RetrieveEmbeddingDfs(subtree->left, full, bag);
+    RetrieveEmbeddingDfs(subtree->left, program, full, bag);
   } else {
     // Forget
     SigEdge forgotten = *(subtree->left->bag - subtree->bag).begin();
@@ -119,35 +479,73 @@ void RetrieveEmbeddingDfs(const Dynamic::Result &subtree, SlowEmbedding *full, S
     int lowest = idx > 0 ? (*bag)(bag->Domain().Nth(idx)).id + 1 : 0;
     int highest = idx < bag->Domain().Size() ? (*bag)(bag->Domain().Nth(idx + 1)).id - 1 : bag->Codomain() - 1;
 
+    // The scan reads through the deferred Introduce tables to the first table below them, recomputed if released.
+    Dynamic::ResultStruct *source = subtree->left.get();
+    while (program.Deferred(*source))
+      source = source->left.get();
+    bool recomputed = source->table.Released();
+    if (recomputed)
+      program.Recompute(source);
     int64_t best = std::numeric_limits<int64_t>::min();
     int best_i = -1;
     for (int i = lowest; i <= highest; ++i) {
       bag->SetVal(forgotten, CycleEdge(i));
-      int64_t now = subtree->left->table[bag->Index()];
+      int64_t now = program.At(*subtree->left, *bag);
       if (now > best) {
         best = now;
         best_i = i;
       }
     }
+    if (recomputed)
+      source->table.Release();
     full->SetVal(forgotten, CycleEdge(best_i));
     bag->SetVal(forgotten, CycleEdge(best_i));
 
-    RetrieveEmbeddingDfs(subtree->left, full, bag);
+    RetrieveEmbeddingDfs(subtree->left, program, full, bag);
   }
 }
 
-SlowEmbedding RetrieveEmbedding(const Dynamic::Result &root, int graph_size) {
+// Each table released by the program is recomputed at most once, and released again once its forgotten edge is
+// retrieved.
+template<class G>
+SlowEmbedding RetrieveEmbedding(const Dynamic::Result &root, int graph_size, const DynamicProgram<G> &program) {
   SlowEmbedding full(graph_size), bag(graph_size);
-  RetrieveEmbeddingDfs(root, &full, &bag);
+  RetrieveEmbeddingDfs(root, program.Keeping(), &full, &bag);
   return full;
 }
 
+}  // namespace
+
+Kmove DynamicKopt(const Decomposition &decomposition, MatchingId id, const Graph &graph,
+                  std::shared_ptr<const CandidateGraph> candidates, bool lean, int64_t min_gain) {
+  Matching matching(id);
+  return graph.Visit([&](const auto &view) {
+    using G = std::decay_t<decltype(view)>;
+    DynamicProgram<G> program(graph.N(), GainFunc<G>(view, matching), candidates, lean);
+    auto result = decomposition.Dfs(program);
+    int64_t gain = result->table[0];
+    if (gain <= min_gain)
+      return Kmove{};
+    return Kmove{gain, id, RetrieveEmbedding(result, graph.N(), program)};
+  });
+}
+
 std::ostream& operator<<(std::ostream &stream, const Dynamic::Result &result) {
   return stream << "bag: " << result->bag << "\ntable: " << result->table;
 }
 
 std::ostream& operator<<(std::ostream &stream, const Dynamic::Table &table) {
   stream << "{\n";
+  if (table.sparse_) {
+    for (auto &entry : table.entries_) {
+      SlowEmbedding embedding(table.graph_size_);
+      int i = 0;
+      for (auto edge : table.bag_)
+        embedding.SetVal(edge, CycleEdge(entry.values[i++]));
+      stream << embedding << ": " << entry.gain << '\n';
+    }
+    return stream << "}\n";
+  }
   Embedding embedding(table.bag_, table.graph_size_);
   do {
     stream << embedding << ": " << table[embedding] << '\n';
@@ -1,49 +1,87 @@
 #ifndef KOPT_CLEVER_DYNAMIC_H_
 #define KOPT_CLEVER_DYNAMIC_H_
 
+#include <array>
 #include <memory>
 #include <ostream>
+#include <vector>
 
+#include <decomposition.h>
+#include <graph.h>
 #include <slow_embedding.h>
-#include <gain_func.h>
 #include <identifier.h>
 #include <set.h>
+#include "spatial_index.h"
 
 namespace kopt {
 
+// The pairs of positions on the current cycle of a graph that are candidate neighbors, i.e. one of them is among the
+// candidates of the other. It is indexed by positions, so it is invalidated by Graph::Permutate.
+class CandidateGraph {
+ public:
+  CandidateGraph(const Graph &, const NeighborLists &);
+
+  int Degree(int u) const { return offsets_[u + 1] - offsets_[u]; }
+  // The positions adjacent to u, in increasing order.
+  const int *operator[](int u) const { return adjacent_.data() + offsets_[u]; }
+  bool Adjacent(int u, int v) const;
+
+ private:
+  std::vector<int> offsets_, adjacent_;
+};
+
+// The tables of the dynamic program of DynamicKopt: a table per node of the decomposition, holding the best gain of
+// the subtree below for every embedding of its bag.
 class Dynamic {
  public:
   using Bag = Set<SigEdge>;
   class Table;
   class ResultStruct;
   using Result = std::unique_ptr<ResultStruct>;
-
-  Dynamic(int graph_size, GainFunc gain);
-
-  Result Leaf() const;
-  Result Introduce(SigEdge introduced, Result child) const;
-  Result Forget(SigEdge forgotten, Result child) const;
-  Result Join(Result left, Result right) const;
-
- private:
-  const int graph_size_;
-  const GainFunc gain_;
 };
 
 class Dynamic::Table {
  public:
-  Table(Bag bag, int graph_size);
+  static constexpr int kMaxBag = 8;
+  // An embedding of the bag stored in a sparse table, as the values of the edges of the bag in increasing order, with
+  // the remaining values set to 0.
+  struct Entry {
+    std::array<int, kMaxBag> values{};
+    int64_t gain;
+
+    bool operator<(const Entry &right) const { return values < right.values; }
+  };
 
+  // A dense table, with a cell for every embedding of the bag.
+  Table(Bag bag, int graph_size);
+  // A sparse table holding the given embeddings of the bag, sorted by their values, with distinct values.
+  Table(Bag bag, int graph_size, std::vector<Entry> entries);
+  // A released table, to be computed later.
+  static Table Deferred(Bag bag, int graph_size);
+
+  bool Sparse() const { return sparse_; }
+  // Frees the cells, which stay unusable until the table is computed again.
+  void Release();
+  bool Released() const { return released_; }
+  const std::vector<Entry> &Entries() const { return entries_; }
+  // The gain of the embedding of the bag, in both modes. Embeddings missing from a sparse table are not admissible.
+  int64_t At(const SlowEmbedding &embedding) const;
+
+  // Access to the cells of a dense table. An int index of a sparse table refers to its entries in sorted order, so
+  // index 0 is the only embedding of the empty bag in both modes.
   template<class Index>
   int64_t& operator[](const Index &idx);
-  int64_t& operator[](int idx) { return table_[idx]; }
+  int64_t& operator[](int idx) { return sparse_ ? entries_[idx].gain : table_[idx]; }
   
   template<class Index>
   const int64_t& operator[](const Index &idx) const;
-  const int64_t& operator[](int idx) const { return table_[idx]; }
+  const int64_t& operator[](int idx) const { return sparse_ ? entries_[idx].gain : table_[idx]; }
 
  private:
   std::vector<int64_t> table_;
+  bool sparse_ = false;
+  bool released_ = false;
+  std::vector<Entry> entries_;
   
   // Used for printing
   Bag bag_;
@@ -64,7 +102,25 @@ class Dynamic::ResultStruct {
   Result left, right;
 };
 
-SlowEmbedding RetrieveEmbedding(const Dynamic::Result &root, int graph_size);
+// The best move of the signature by the dynamic program over the decomposition of its dependence graph. Dispatches
+// on the view of the graph once (see Graph::Visit), so that the operations compute the gains without switches.
+// Returns a move with gain 0 if no move gains more than min_gain, which also skips the retrieval of its embedding.
+//
+// The exact mode, without candidates: the tables have a cell for every embedding of their bag, Binom(n, |bag|) in
+// total.
+//
+// The sparse mode, with candidates: an embedding is admissible only if every added edge between the endpoints of its
+// edges joins candidate neighbors, and the tables only hold the admissible embeddings, so that their size and the
+// running time are proportional to the number of admissible embeddings. The result is the best move all of whose
+// added edges join candidate neighbors.
+//
+// With lean, the operations release the table of a child once the table of its parent is built, except for the
+// tables of Join nodes, which stay as checkpoints. Only the checkpoints and the two tables of the current operation
+// are then alive at a time, instead of the tables of the whole decomposition. In the exact mode, Introduce also defers
+// its table, which is the largest one, Binom(n, tw + 1) cells: a Forget reads through it from the table below. The
+// retrieval recomputes the released tables it needs from the nearest checkpoints below them, each at most once.
+Kmove DynamicKopt(const Decomposition &, MatchingId, const Graph &, std::shared_ptr<const CandidateGraph> candidates,
+                  bool lean = false, int64_t min_gain = 0);
 
 std::ostream& operator<<(std::ostream &, const Dynamic::Result &);
 std::ostream& operator<<(std::ostream &, const Dynamic::Table &);
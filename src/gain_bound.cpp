@@ -0,0 +1,93 @@
+#include "gain_bound.h"
+
+#include <atomic>
+#include <cassert>
+
+#include "spatial_index.h"
+
+namespace kopt {
+namespace {
+
+std::atomic<std::int64_t> skipped{0};
+
+// Whether the nearest node by Euclidean distance is also the nearest one by the metric, which holds if the weights
+// increase with the Euclidean distance.
+bool EuclideanOrder(EdgeWeightType type) {
+  return type == EdgeWeightType::kEuc2d || type == EdgeWeightType::kCeil2d || type == EdgeWeightType::kAtt;
+}
+
+}  // namespace
+
+GainBound::GainBound(const Graph &graph) : by_id_(graph), nearest_(graph.N()) {
+  int n = graph.N();
+  by_id_.Permutate(Inverse(graph.GetPermutation()));
+  if (n >= 2 && (!graph.HasCoordinates() || EuclideanOrder(graph.GetEdgeWeightType()))) {
+    auto lists = NeighborLists::Build(graph, 1);
+    for (int id = 0; id < n; ++id)
+      nearest_[id] = by_id_(id, (*lists)[id][0]);
+  }
+  Update(graph);
+}
+
+void GainBound::Update(const Graph &graph) {
+  int n = graph.N();
+  const auto &perm = graph.GetPermutation();
+  slacks_.clear();
+  for (int i = 0; i < n; ++i)
+    slacks_.insert(2 * graph.EdgeWeight(i) - nearest_[perm[i]] - nearest_[perm[(i + 1) % n]]);
+  SetTop(n > 0 ? perm[0] : -1);
+}
+
+void GainBound::Update(const Matching &matching, const std::vector<std::pair<int, int>> &edges, int first) {
+  for (auto [u, v] : edges) {
+    auto it = slacks_.find(Slack(u, v));
+    assert(it != slacks_.end());
+    slacks_.erase(it);
+  }
+  auto endpoint = [&](SigNode node) {
+    auto &edge = edges[node.Edge().id];
+    return node.IsLeft() ? edge.first : edge.second;
+  };
+  for (int i = 0; i < 2 * Size(edges); ++i)
+    if (i < matching(SigNode(i)).id)
+      slacks_.insert(Slack(endpoint(SigNode(i)), endpoint(matching(SigNode(i)))));
+  SetTop(first);
+}
+
+void GainBound::SetTop(int first) {
+  top_.fill(0);
+  auto it = slacks_.rbegin();
+  for (int k = 1; k <= kMaxK; ++k) {
+    top_[k] = top_[k - 1];
+    if (it != slacks_.rend())
+      top_[k] += *it++;
+  }
+  wrap_ = first >= 0 ? nearest_[first] : 0;
+}
+
+int64_t GainBound::Bound(MatchingId id) const {
+  int k;
+  bool wraps;
+  if (id[0] == '#') {
+    k = id[1] - '0';
+    wraps = true;
+  } else {
+    k = Len(id) + 1;
+    wraps = Matching(id)(SigNode(0)).id == 2 * k - 1;
+  }
+  assert(1 <= k && k <= kMaxK);
+  // Rounds the half of top_ down.
+  int64_t twice = top_[k] + (wraps ? 2 * wrap_ : 0);
+  return twice >= 0 ? twice / 2 : -((1 - twice) / 2);
+}
+
+bool GainBound::Hopeless(MatchingId id) const {
+  if (Bound(id) > 0)
+    return false;
+  ++skipped;
+  return true;
+}
+
+std::int64_t SkippedSignatures() { return skipped; }
+
+}  // namespace kopt
@@ -0,0 +1,64 @@
+#ifndef KOPT_SRC_GAIN_BOUND_H_
+#define KOPT_SRC_GAIN_BOUND_H_
+
+#include <array>
+#include <cstdint>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "graph.h"
+#include "matching.h"
+
+namespace kopt {
+
+// Upper bounds on the gain of the k-opt moves of the current cycle of a graph, to skip signatures which cannot
+// improve it. Every endpoint of a removed edge gets an added edge, which weighs at least the distance from the
+// endpoint to its nearest neighbor. A removed edge (a, b) thus gains at most its slack w(a, b) - (nn(a) + nn(b)) / 2,
+// and a move removing k edges at most the sum of the k largest slacks.
+class GainBound {
+ public:
+  static constexpr int kMaxK = 7;
+
+  // Finds the nearest neighbors. Their distances are exact for EXPLICIT graphs and the metrics increasing with the
+  // Euclidean distance (EUC_2D, CEIL_2D, ATT); the other metrics use 0, bounding the gain by the removed edges alone.
+  explicit GainBound(const Graph &);
+
+  // Recomputes the slacks for the current cycle of the graph.
+  void Update(const Graph &);
+  // Updates the slacks after an improvement given by its matching and its removed edges (u, v) by original ids, with
+  // v following u along the cycle, in cycle order starting from the first one, as NeighborKopt::Apply takes it. Only
+  // the slacks of the k removed and the k added edges change. first is the original id of the node now at position 0.
+  void Update(const Matching &, const std::vector<std::pair<int, int>> &edges, int first);
+  // A bound on the gain of the moves of the signature, or of any signature with k edges for the ids "#k" of the
+  // engines searching several of them.
+  int64_t Bound(MatchingId) const;
+  // Whether no move of the signature improves the cycle. Counts the signatures skipped this way, see
+  // SkippedSignatures().
+  bool Hopeless(MatchingId) const;
+
+ private:
+  // The slack of the edge between the nodes with the given original ids.
+  int64_t Slack(int u, int v) const { return 2 * by_id_(u, v) - nearest_[u] - nearest_[v]; }
+  // Sums the largest slacks into top_ and sets wrap_.
+  void SetTop(int first);
+
+  // The graph with its nodes in the order of the original ids, for the weights of the changed edges.
+  Graph by_id_;
+  // The distance to the nearest neighbor, by original id.
+  std::vector<Weight> nearest_;
+  // The slacks of the edges of the cycle.
+  std::multiset<int64_t> slacks_;
+  // Twice the sum of the k largest slacks, to keep them integers.
+  std::array<int64_t, kMaxK + 1> top_{};
+  // The nearest neighbor distance of the node at position 0. An added edge joining the endpoints 0 and 2k - 1 joins
+  // this node to itself when the first and the last edge of the cycle are removed, and may weigh nothing.
+  Weight wrap_ = 0;
+};
+
+// The number of signature searches skipped by GainBound::Hopeless in this process.
+std::int64_t SkippedSignatures();
+
+}  // namespace kopt
+
+#endif  // KOPT_SRC_GAIN_BOUND_H_
@@ -9,16 +9,20 @@
 
 namespace kopt {
 
+// G is a view of the graph (see Graph::Visit), so that the weights are computed without dispatching on the graph.
+template<class G>
 class GainFunc {
  public:
-  // Saves the references to graph and matching - no copies are made.
-  GainFunc(const Graph &graph, const Matching &matching) : graph_(graph), matching_(matching) {}
+  // Copies the view, which is a few pointers, and saves the reference to the matching.
+  GainFunc(const G &graph, const Matching &matching) : graph_(graph), matching_(matching) {}
 
   int64_t Introduce(const EmbeddingInterface &embedding, SigEdge introduced) const;
   int64_t Join(const EmbeddingInterface &embedding) const;
 
+  const Matching &GetMatching() const { return matching_; }
+
  private:
-  const Graph &graph_;
+  const G graph_;
   const Matching &matching_;
 
   int64_t Check(const EmbeddingInterface &embedding, SigNode x, bool require_ordered = false) const;
@@ -27,27 +31,30 @@ class GainFunc {
 // Implementation
 // =====================================================================================================================
 
-inline int64_t GainFunc::Introduce(const EmbeddingInterface &embedding, SigEdge introduced) const {
-  int64_t gain = graph_.GetWeight(embedding(introduced));
+template<class G>
+inline int64_t GainFunc<G>::Introduce(const EmbeddingInterface &embedding, SigEdge introduced) const {
+  int64_t gain = graph_.EdgeWeight(embedding(introduced).id);
   gain -= Check(embedding, introduced.Left());
   gain -= Check(embedding, introduced.Right());
   return gain;
 }
 
-inline int64_t GainFunc::Join(const EmbeddingInterface &embedding) const {
+template<class G>
+inline int64_t GainFunc<G>::Join(const EmbeddingInterface &embedding) const {
   int64_t gain = 0;
   for (auto edge : embedding.Domain()) {
-    gain += graph_.GetWeight(embedding(edge));
+    gain += graph_.EdgeWeight(embedding(edge).id);
     gain -= Check(embedding, edge.Left(), true);
     gain -= Check(embedding, edge.Right(), true);
   }
   return gain;
 }
 
-inline int64_t GainFunc::Check(const EmbeddingInterface &embedding, SigNode x, bool require_ordered) const {
+template<class G>
+inline int64_t GainFunc<G>::Check(const EmbeddingInterface &embedding, SigNode x, bool require_ordered) const {
   SigNode y = matching_(x);
   if ((!require_ordered || x.id < y.id) && embedding.Domain().Contains(y.Edge()))
-    return graph_.GetWeight(embedding(x), embedding(y));
+    return graph_(embedding(x).id, embedding(y).id);
   else
     return 0;
 }
@@ -1,12 +1,145 @@
 #include "graph.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <functional>
+#include <iterator>
 #include <random>
-#include <sstream>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include "common.h"
+#include "instance_cache.h"
+#include "mapped_file.h"
+#include "tsplib.h"
 
 namespace kopt {
+namespace {
+
+template<class T>
+using DistancesKernel = void (*)(Point u, const T *x, const T *y, int count, Weight *out);
+
+template<class Metric, class T>
+void DistancesScalar(Point u, const T *x, const T *y, int count, Weight *out) {
+  for (int i = 0; i < count; ++i)
+    out[i] = Metric::Dist(u, Point{static_cast<double>(x[i]), static_cast<double>(y[i])});
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// The kernels below compute EUC_2D distances with exactly the same IEEE operations as Euc2d (no FMA), so the results
+// are bit-identical. The other metrics use DistancesScalar.
+
+template<class T>
+__attribute__((target("avx2")))
+void DistancesAvx2(Point u, const T *x, const T *y, int count, Weight *out) {
+  const __m256d ux = _mm256_set1_pd(u.x), uy = _mm256_set1_pd(u.y);
+  const __m256d half = _mm256_set1_pd(0.5), limit = _mm256_set1_pd(2147483647.0);
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256d px, py;
+    if constexpr (std::is_same_v<T, float>) {
+      px = _mm256_cvtps_pd(_mm_loadu_ps(x + i));
+      py = _mm256_cvtps_pd(_mm_loadu_ps(y + i));
+    } else if constexpr (std::is_same_v<T, std::int32_t>) {
+      px = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i)));
+      py = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i *>(y + i)));
+    } else {
+      px = _mm256_loadu_pd(x + i);
+      py = _mm256_loadu_pd(y + i);
+    }
+    __m256d dx = _mm256_sub_pd(ux, px), dy = _mm256_sub_pd(uy, py);
+    __m256d sq = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+    __m256d dist = _mm256_add_pd(_mm256_sqrt_pd(sq), half);
+    if (_mm256_movemask_pd(_mm256_cmp_pd(dist, limit, _CMP_LT_OQ)) == 0xF) {
+      // AVX2 cannot truncate to 64 bits, but all the values fit in 32 bits.
+      __m256i wide = _mm256_cvtepi32_epi64(_mm256_cvttpd_epi32(dist));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), wide);
+    } else {
+      alignas(32) double tmp[4];
+      _mm256_store_pd(tmp, dist);
+      for (int j = 0; j < 4; ++j)
+        out[i + j] = Weight(tmp[j]);
+    }
+  }
+  DistancesScalar<Euc2dMetric>(u, x + i, y + i, count - i, out + i);
+}
+
+template<class T>
+__attribute__((target("avx512f,avx512dq")))
+void DistancesAvx512(Point u, const T *x, const T *y, int count, Weight *out) {
+  const __m512d ux = _mm512_set1_pd(u.x), uy = _mm512_set1_pd(u.y), half = _mm512_set1_pd(0.5);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m512d px, py;
+    if constexpr (std::is_same_v<T, float>) {
+      px = _mm512_maskz_cvtps_pd(0xFF, _mm256_loadu_ps(x + i));
+      py = _mm512_maskz_cvtps_pd(0xFF, _mm256_loadu_ps(y + i));
+    } else if constexpr (std::is_same_v<T, std::int32_t>) {
+      px = _mm512_maskz_cvtepi32_pd(0xFF, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + i)));
+      py = _mm512_maskz_cvtepi32_pd(0xFF, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(y + i)));
+    } else {
+      px = _mm512_loadu_pd(x + i);
+      py = _mm512_loadu_pd(y + i);
+    }
+    __m512d dx = _mm512_sub_pd(ux, px), dy = _mm512_sub_pd(uy, py);
+    __m512d sq = _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy));
+    __m512d dist = _mm512_add_pd(_mm512_maskz_sqrt_pd(0xFF, sq), half);
+    _mm512_storeu_si512(out + i, _mm512_cvttpd_epi64(dist));
+  }
+  DistancesScalar<Euc2dMetric>(u, x + i, y + i, count - i, out + i);
+}
+
+template<class Metric, class T>
+DistancesKernel<T> ChooseDistancesKernel() {
+  if constexpr (!std::is_same_v<Metric, Euc2dMetric>)
+    return &DistancesScalar<Metric, T>;
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+    return &DistancesAvx512<T>;
+  if (__builtin_cpu_supports("avx2"))
+    return &DistancesAvx2<T>;
+  return &DistancesScalar<Metric, T>;
+}
+
+#else
+
+template<class Metric, class T>
+DistancesKernel<T> ChooseDistancesKernel() {
+  return &DistancesScalar<Metric, T>;
+}
+
+#endif
+
+bool RepresentableAsFloats(const std::vector<double> &values) {
+  for (double value : values)
+    if (static_cast<double>(static_cast<float>(value)) != value) return false;
+  return true;
+}
+
+bool SmallIntegers(const std::vector<double> &values) {
+  for (double value : values)
+    if (!(std::abs(value) < kMaxIntegerCoordinate) || std::floor(value) != value) return false;
+  return true;
+}
+
+}  // namespace
+
+const char *Name(EdgeWeightType type) {
+  switch (type) {
+    case EdgeWeightType::kEuc2d: return "EUC_2D";
+    case EdgeWeightType::kCeil2d: return "CEIL_2D";
+    case EdgeWeightType::kAtt: return "ATT";
+    case EdgeWeightType::kGeo: return "GEO";
+    case EdgeWeightType::kMan2d: return "MAN_2D";
+    case EdgeWeightType::kMax2d: return "MAX_2D";
+    case EdgeWeightType::kExplicit: return "EXPLICIT";
+  }
+  abort();
+}
 
 Graph Graph::Random(int n) {
   assert(n >= 0);
@@ -15,74 +148,342 @@ Graph Graph::Random(int n) {
   std::uniform_int_distribution<> dist(1, n);
   auto rand = std::bind(dist, Rng());
   for (int i = 0; i < n; ++i) {
-    g.points[i].x = rand();
-    g.points[i].y = rand();
+    g.points.x[i] = rand();
+    g.points.y[i] = rand();
   }
-  g.points[n] = g.points[0];
+  g.points.x[n] = g.points.x[0];
+  g.points.y[n] = g.points.y[0];
+  g.ComputeEdgeWeights();
+  g.UseIntegerCoordinates();
+  return g;
+}
+
+Graph Graph::FromWeights(std::shared_ptr<const WeightMatrix> weights) {
+  assert(weights);
+  Graph g;
+  g.n = weights->N();
+  g.points.Clear();
+  g.perm = Permutation(g.n);
+  g.edge_weight_type = EdgeWeightType::kExplicit;
+  g.matrix = std::move(weights);
+  g.ids = Sequence(g.n);
+  if (g.n) g.ids.emplace_back(g.ids[0]);
+  g.ComputeEdgeWeights();
   g.CheckInvariant();
   return g;
 }
 
+Graph Graph::FromCoordinates(EdgeWeightType type, std::vector<double> x, std::vector<double> y) {
+  assert(type != EdgeWeightType::kExplicit);
+  assert(x.size() == y.size());
+  Graph g;
+  g.n = Size(x);
+  if (g.n) {
+    x.emplace_back(x[0]);
+    y.emplace_back(y[0]);
+  }
+  g.points.x = std::move(x);
+  g.points.y = std::move(y);
+  g.perm = Permutation(g.n);
+  g.edge_weight_type = type;
+  g.ComputeEdgeWeights();
+  g.CheckInvariant();
+  g.UseIntegerCoordinates();
+  return g;
+}
+
 Graph::Graph(int n) : n(n) {
   assert(n >= 0);
   if (n) {
-    points.resize(n + 1);
+    points.Resize(n + 1);
     perm = Permutation(n);
   }
+  ComputeEdgeWeights();
   CheckInvariant();
 }
 
 void Graph::Permutate(const Permutation &p) {
   assert(p.N() == n);
   if (n) {
-    std::vector<Point> new_points(n + 1);
-    for (int i = 0; i < n; ++i)
-      new_points[i] = points[p[i]];
-    new_points[n] = new_points[0];
-    points.swap(new_points);
-    perm = Compose(p, perm);
+    if (HasCoordinates()) {
+      switch (precision) {
+        case Precision::kDouble: points.Permutate(p); break;
+        case Precision::kSingle: points32.Permutate(p); break;
+        case Precision::kInteger: points_int.Permutate(p); break;
+      }
+    }
+    // The node now at position i was previously at position p[i].
+    perm = Compose(perm, p);
+    if (matrix) {
+      for (int i = 0; i < n; ++i)
+        ids[i] = perm[i];
+      ids[n] = ids[0];
+    }
+    // An edge whose ends were adjacent before keeps its weight, so a k-opt move computes only k new weights.
+    std::vector<Weight> new_weights(n);
+    tour_weight = 0;
+    for (int i = 0; i < n; ++i) {
+      int u = p[i], v = p[i + 1 < n ? i + 1 : 0];
+      if (v == (u + 1 < n ? u + 1 : 0))
+        new_weights[i] = edge_weights[u];
+      else if (u == (v + 1 < n ? v + 1 : 0))
+        new_weights[i] = edge_weights[v];
+      else
+        new_weights[i] = Dist(i, i + 1);
+      tour_weight += new_weights[i];
+    }
+    edge_weights = std::move(new_weights);
   }
   CheckInvariant();
 }
 
+void Graph::ComputeEdgeWeights() {
+  edge_weights.resize(n);
+  tour_weight = 0;
+  for (int i = 0; i < n; ++i) {
+    edge_weights[i] = Dist(i, i + 1);
+    tour_weight += edge_weights[i];
+  }
+}
+
+template<class T>
+void Graph::Points<T>::Permutate(const Permutation &p) {
+  int n = p.N();
+  std::vector<T> new_x(n + 1), new_y(n + 1);
+  for (int i = 0; i < n; ++i) {
+    new_x[i] = x[p[i]];
+    new_y[i] = y[p[i]];
+  }
+  new_x[n] = new_x[0];
+  new_y[n] = new_y[0];
+  x.swap(new_x);
+  y.swap(new_y);
+}
+
 const Permutation &Graph::GetPermutation() const {
   return perm;
 }
 
-std::istream& operator>>(std::istream &stream, Graph &graph) {
-  std::vector<Point> points;
-  std::string line;
-  bool coord_section = false;
-  while (std::getline(stream, line)) {
-    if (line == "NODE_COORD_SECTION") {
-      coord_section = true;
-    } else if (line == "EOF") {
-      coord_section = false;
-    } else if (coord_section) {
-      std::istringstream ss(line);
-      int id;
-      double x, y;
-      ss >> id >> x >> y;
-      points.emplace_back(Point{x, y});
+void Graph::Distances(int u, int a, int b, Weight *out) const {
+  CheckIdx(u);
+  assert(0 <= a && a <= b && b <= n + 1);
+  if (matrix) {
+    auto copy_row = [&](auto *data) {
+      auto *row = data + std::size_t(ids[u]) * n;
+      for (int v = a; v < b; ++v)
+        out[v - a] = row[ids[v]];
+    };
+    if (matrix->Narrow())
+      copy_row(matrix->Data16());
+    else
+      copy_row(matrix->Data32());
+    return;
+  }
+  VisitCoordinates([&](auto metric, const auto &coords) {
+    using T = typename std::decay_t<decltype(coords.x)>::value_type;
+    static const DistancesKernel<T> kernel = ChooseDistancesKernel<decltype(metric), T>();
+    kernel(coords[u], coords.x.data() + a, coords.y.data() + a, b - a, out);
+  });
+}
+
+bool Graph::BuildDistanceMatrix() {
+  if (matrix)
+    return true;
+  // Each row is computed in the order of the cycle and stored by original ids, one row after another. The diagonal is
+  // computed too, as it is not zero for GEO.
+  std::vector<Weight> row(n);
+  auto fill = [&](auto *data) {
+    using T = std::remove_pointer_t<decltype(data)>;
+    for (int i = 0; i < n; ++i) {
+      Distances(i, 0, n, row.data());
+      T *out = data + std::size_t(perm[i]) * n;
+      for (int j = 0; j < n; ++j) {
+        if (row[j] < std::numeric_limits<T>::min() || row[j] > std::numeric_limits<T>::max())
+          return false;
+        out[perm[j]] = static_cast<T>(row[j]);
+      }
     }
+    return true;
+  };
+  // The weights are built as 16-bit integers and built again as 32-bit ones from the first one which does not fit.
+  matrix = WeightMatrix::Build(n, true, fill);
+  if (!matrix)
+    matrix = WeightMatrix::Build(n, false, fill);
+  if (!matrix)
+    return false;
+  ids.resize(n + 1);
+  for (int i = 0; i < n; ++i)
+    ids[i] = perm[i];
+  if (n) ids[n] = ids[0];
+  CheckInvariant();
+  return true;
+}
+
+void Graph::DropDistanceMatrix() {
+  if (!HasCoordinates())
+    return;
+  matrix.reset();
+  ids.clear();
+  CheckInvariant();
+}
+
+bool Graph::UseSinglePrecision() {
+  if (!HasCoordinates())
+    return false;
+  auto values = DoublePoints();
+  if (!RepresentableAsFloats(values.x) || !RepresentableAsFloats(values.y))
+    return false;
+  SetPrecision(Precision::kSingle, values);
+  return true;
+}
+
+bool Graph::UseIntegerCoordinates() {
+  if (!HasCoordinates())
+    return false;
+  auto values = DoublePoints();
+  if (!SmallIntegers(values.x) || !SmallIntegers(values.y))
+    return false;
+  SetPrecision(Precision::kInteger, values);
+  return true;
+}
+
+void Graph::UseDoublePrecision() {
+  if (!HasCoordinates())
+    return;
+  SetPrecision(Precision::kDouble, DoublePoints());
+}
+
+Graph::Points<double> Graph::DoublePoints() const {
+  Points<double> result;
+  switch (precision) {
+    case Precision::kDouble:
+      return points;
+    case Precision::kSingle:
+      result.x.assign(points32.x.begin(), points32.x.end());
+      result.y.assign(points32.y.begin(), points32.y.end());
+      return result;
+    case Precision::kInteger:
+      result.x.assign(points_int.x.begin(), points_int.x.end());
+      result.y.assign(points_int.y.begin(), points_int.y.end());
+      return result;
+  }
+  abort();
+}
+
+void Graph::SetPrecision(Precision new_precision, const Points<double> &values) {
+  points.Clear();
+  points32.Clear();
+  points_int.Clear();
+  switch (new_precision) {
+    case Precision::kDouble:
+      points = values;
+      break;
+    case Precision::kSingle:
+      points32.x.assign(values.x.begin(), values.x.end());
+      points32.y.assign(values.y.begin(), values.y.end());
+      break;
+    case Precision::kInteger:
+      points_int.x.assign(values.x.begin(), values.x.end());
+      points_int.y.assign(values.y.begin(), values.y.end());
+      break;
+  }
+  precision = new_precision;
+  CheckInvariant();
+}
+
+namespace {
+
+// Parses the contents of a TSPLIB file, or prints the error.
+bool ParseInstance(std::string_view text, int threads, CachedInstance *instance) {
+  TsplibData data;
+  std::string error;
+  if (!ParseTsplib(text, threads, &data, &error)) {
+    std::cerr << error << '\n';
+    return false;
+  }
+  instance->type = data.type;
+  instance->n = data.dimension;
+  if (data.type == EdgeWeightType::kExplicit) {
+    instance->weights = WeightMatrix::Pack(data.dimension, std::move(data.weights));
+  } else {
+    instance->x = std::move(data.x);
+    instance->y = std::move(data.y);
+  }
+  return true;
+}
+
+Graph FromInstance(CachedInstance &&instance) {
+  if (instance.type == EdgeWeightType::kExplicit)
+    return Graph::FromWeights(std::move(instance.weights));
+  return Graph::FromCoordinates(instance.type, std::move(instance.x), std::move(instance.y));
+}
+
+}  // namespace
+
+std::istream& operator>>(std::istream &stream, Graph &graph) {
+  std::string text(std::istreambuf_iterator<char>(stream), {});
+  CachedInstance instance;
+  if (ParseInstance(text, 1, &instance)) {
+    graph = FromInstance(std::move(instance));
+  } else {
+    graph = Graph();
+    stream.setstate(std::ios::failbit);
   }
-  points.emplace_back(points[0]);
-  graph.n = Size(points) - 1;
-  graph.points.swap(points);
-  graph.perm = Permutation(graph.n);
-  graph.CheckInvariant();
   return stream;
 }
 
+bool ReadGraph(const std::string &path, Graph *graph, int threads, bool cache, std::uint64_t *input_checksum) {
+  auto file = MappedFile::Open(path);
+  if (!file)
+    return false;
+  std::uint64_t checksum = Checksum(file->View());
+  if (input_checksum)
+    *input_checksum = checksum;
+  std::string cache_path = InstanceCachePath(path);
+  CachedInstance instance;
+  if (cache && LoadInstanceCache(cache_path, checksum, &instance)) {
+    *graph = FromInstance(std::move(instance));
+    return true;
+  }
+  if (!ParseInstance(file->View(), threads, &instance)) {
+    *graph = Graph();
+    return true;
+  }
+  if (cache && !SaveInstanceCache(cache_path, checksum, instance))
+    std::cerr << "Failed to write '" << cache_path << "'\n";
+  *graph = FromInstance(std::move(instance));
+  return true;
+}
+
 void Graph::CheckInvariant() const {
   assert(n >= 0);
-  if (n == 0) {
-    assert(Size(points) == 0);
-  } else {
-    assert(Size(points) == n + 1);
-    assert(points[0].x == points[n].x && points[0].y == points[n].y);
+  int stored = n && HasCoordinates() ? n + 1 : 0;
+  assert(points.Size() == (precision == Precision::kDouble ? stored : 0));
+  assert(points32.Size() == (precision == Precision::kSingle ? stored : 0));
+  assert(points_int.Size() == (precision == Precision::kInteger ? stored : 0));
+  if (stored) {
+    [[maybe_unused]] Point first = Coord(0), last = Coord(n);
+    assert(first.x == last.x && first.y == last.y);
   }
   assert(perm.N() == n);
+  assert(HasCoordinates() || matrix);
+  if (matrix) {
+    assert(matrix->N() == n);
+    assert(Size(ids) == n + 1);
+    assert(n == 0 || ids[0] == ids[n]);
+  } else {
+    assert(ids.empty());
+  }
+  assert(Size(edge_weights) == n);
+#ifndef NDEBUG
+  // Cross-checks the cached weights against a full recomputation.
+  Weight weight = 0;
+  for (int i = 0; i < n; ++i) {
+    assert(edge_weights[i] == Dist(i, i + 1));
+    weight += edge_weights[i];
+  }
+  assert(weight == tour_weight);
+#endif
 }
 
 Weight CycleWeight(const Graph &graph, const Permutation &cycle) {
@@ -99,10 +500,19 @@ void WriteGraph(std::ostream *out, const Graph &graph, const std::string &name)
     *out << "NAME : " << name << '\n';
   *out << "TYPE : TSP\n";
   *out << "DIMENSION : " << graph.N() << '\n';
-  *out << "EDGE_WEIGHT_TYPE : EUC_2D\n";
-  *out << "NODE_COORD_SECTION\n";
-  for (int i = 0; i < graph.N(); ++i)
-    *out << i + 1 << ' ' << graph[i].x << ' ' << graph[i].y << '\n';
+  *out << "EDGE_WEIGHT_TYPE : " << Name(graph.GetEdgeWeightType()) << '\n';
+  if (graph.HasCoordinates()) {
+    *out << "NODE_COORD_SECTION\n";
+    for (int i = 0; i < graph.N(); ++i)
+      *out << i + 1 << ' ' << graph[i].x << ' ' << graph[i].y << '\n';
+  } else {
+    *out << "EDGE_WEIGHT_FORMAT : FULL_MATRIX\n";
+    *out << "EDGE_WEIGHT_SECTION\n";
+    for (int i = 0; i < graph.N(); ++i) {
+      for (int j = 0; j < graph.N(); ++j)
+        *out << graph(i, j) << (j + 1 < graph.N() ? ' ' : '\n');
+    }
+  }
   *out << "EOF\n";
 }
 
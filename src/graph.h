@@ -1,13 +1,18 @@
 #ifndef KOPT_CLEVER_GRAPH_H_
 #define KOPT_CLEVER_GRAPH_H_
 
+#include <algorithm>
+#include <cassert>
 #include <cmath>
 #include <cstdint>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <type_traits>
 #include <vector>
 
 #include "permutation.h"
+#include "weight_matrix.h"
 
 namespace kopt {
 
@@ -19,9 +24,141 @@ struct Point {
   double x, y;
 };
 
+inline Weight Euc2d(Point a, Point b) {
+  // TSPLIB documentation dictates the use of cast instead of round().
+  // NOLINTNEXTLINE(bugprone-incorrect-roundings)
+  return Weight(std::sqrt((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y)) + 0.5);
+}
+
+// Graphs with integer coordinates smaller than this in absolute value store them as 32-bit integers. The squared
+// distances between such points are below 2^47, so they are exact in double precision and all the metrics give the
+// same results as with double coordinates.
+constexpr std::int32_t kMaxIntegerCoordinate = 1 << 22;
+
+// The supported TSPLIB EDGE_WEIGHT_TYPEs. Each geometric type has a metric policy below; EXPLICIT weights are stored
+// in a WeightMatrix.
+enum class EdgeWeightType { kEuc2d, kCeil2d, kAtt, kGeo, kMan2d, kMax2d, kExplicit };
+
+// The TSPLIB name of the type, e.g. "EUC_2D".
+const char *Name(EdgeWeightType);
+
+// Metric policies: Dist(a, b) is the distance between points with the given coordinates, as defined by TSPLIB.
+// Templates parametrized by a policy (see Graph::Visit) get the distance function inlined.
+
+struct Euc2dMetric {
+  static constexpr EdgeWeightType kType = EdgeWeightType::kEuc2d;
+  static Weight Dist(Point a, Point b) { return Euc2d(a, b); }
+};
+
+struct Ceil2dMetric {
+  static constexpr EdgeWeightType kType = EdgeWeightType::kCeil2d;
+  static Weight Dist(Point a, Point b) {
+    return Weight(std::ceil(std::sqrt((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y))));
+  }
+};
+
+// Pseudo-Euclidean distance.
+struct AttMetric {
+  static constexpr EdgeWeightType kType = EdgeWeightType::kAtt;
+  static Weight Dist(Point a, Point b) {
+    double r = std::sqrt(((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y)) / 10.0);
+    // NOLINTNEXTLINE(bugprone-incorrect-roundings)
+    Weight t = Weight(r + 0.5);
+    return t < r ? t + 1 : t;
+  }
+};
+
+// Geographical distance in kilometers; x is the latitude and y the longitude, in the DDD.MM format.
+struct GeoMetric {
+  static constexpr EdgeWeightType kType = EdgeWeightType::kGeo;
+  static Weight Dist(Point a, Point b) {
+    constexpr double kRadius = 6378.388;
+    double lat_a = Radians(a.x), lon_a = Radians(a.y), lat_b = Radians(b.x), lon_b = Radians(b.y);
+    double q1 = std::cos(lon_a - lon_b), q2 = std::cos(lat_a - lat_b), q3 = std::cos(lat_a + lat_b);
+    return Weight(kRadius * std::acos(0.5 * ((1.0 + q1) * q2 - (1.0 - q1) * q3)) + 1.0);
+  }
+
+  static double Radians(double x) {
+    // TSPLIB truncates the degrees and uses this approximation of pi.
+    constexpr double kPi = 3.141592;
+    double degrees = std::trunc(x);
+    return kPi * (degrees + 5.0 * (x - degrees) / 3.0) / 180.0;
+  }
+};
+
+struct Man2dMetric {
+  static constexpr EdgeWeightType kType = EdgeWeightType::kMan2d;
+  static Weight Dist(Point a, Point b) {
+    // NOLINTNEXTLINE(bugprone-incorrect-roundings)
+    return Weight(std::abs(a.x - b.x) + std::abs(a.y - b.y) + 0.5);
+  }
+};
+
+struct Max2dMetric {
+  static constexpr EdgeWeightType kType = EdgeWeightType::kMax2d;
+  static Weight Dist(Point a, Point b) {
+    // NOLINTNEXTLINE(bugprone-incorrect-roundings)
+    return std::max(Weight(std::abs(a.x - b.x) + 0.5), Weight(std::abs(a.y - b.y) + 0.5));
+  }
+};
+
+// A read-only view of a graph stored as coordinates of type T, with the metric fixed at compile time.
+template<class Metric, class T>
+class CoordinateView {
+ public:
+  CoordinateView(int n, const T *x, const T *y, const Weight *edges) : n_(n), x_(x), y_(y), edges_(edges) {}
+
+  int N() const { return n_; }
+  Weight operator()(int u, int v) const {
+    assert(0 <= u && u <= n_ && 0 <= v && v <= n_);
+    return Metric::Dist(Coord(u), Coord(v));
+  }
+  // The cached weight of the cycle edge (i, i+1), see Graph::EdgeWeight.
+  Weight EdgeWeight(int i) const {
+    assert(0 <= i && i < n_);
+    return edges_[i];
+  }
+
+ private:
+  Point Coord(int v) const { return Point{static_cast<double>(x_[v]), static_cast<double>(y_[v])}; }
+
+  int n_;
+  const T *x_, *y_;
+  const Weight *edges_;
+};
+
+// A read-only view of a graph with a WeightMatrix of weights of type T. The matrix is indexed by the original node ids.
+template<class T>
+class MatrixView {
+ public:
+  MatrixView(int n, const T *matrix, const int *ids, const Weight *edges)
+      : n_(n), matrix_(matrix), ids_(ids), edges_(edges) {}
+
+  int N() const { return n_; }
+  Weight operator()(int u, int v) const {
+    assert(0 <= u && u <= n_ && 0 <= v && v <= n_);
+    return matrix_[std::size_t(ids_[u]) * n_ + ids_[v]];
+  }
+  // The cached weight of the cycle edge (i, i+1), see Graph::EdgeWeight.
+  Weight EdgeWeight(int i) const {
+    assert(0 <= i && i < n_);
+    return edges_[i];
+  }
+
+ private:
+  int n_;
+  const T *matrix_;
+  const int *ids_;
+  const Weight *edges_;
+};
+
 class Graph {
  public:
   static Graph Random(int n);
+  // A graph with the given coordinates (without the sentinel) and a metric other than EXPLICIT.
+  static Graph FromCoordinates(EdgeWeightType, std::vector<double> x, std::vector<double> y);
+  // A graph with the given EXPLICIT weights and no coordinates.
+  static Graph FromWeights(std::shared_ptr<const WeightMatrix>);
   explicit Graph(int n = 0);
 
   Graph(const Graph &) = default;
@@ -31,23 +168,62 @@ class Graph {
   Graph &operator=(Graph &&) = default;
 
   int N() const { return n; }
-  const Point &operator[](int v) const { return points[CheckIdx(v)]; }
+  bool HasCoordinates() const { return edge_weight_type != EdgeWeightType::kExplicit; }
+  Point operator[](int v) const {
+    assert(HasCoordinates());
+    return Coord(CheckIdx(v));
+  }
   Weight operator()(int u, int v) const { return Dist(CheckIdx(u), CheckIdx(v)); }
+  // Writes the distances from u to the nodes a, a+1, ..., b-1 into out[0], out[1], ..., out[b-a-1]. Uses SIMD where
+  // available; the results are identical to calling operator() on each pair.
+  void Distances(int u, int a, int b, Weight *out) const;
+  // The weight of the cycle edge (i, i+1) for 0 <= i < n and the weight of the whole cycle. Both are cached and kept up
+  // to date by Permutate, which only computes the weights of edges that were not in the cycle before.
+  Weight EdgeWeight(int i) const {
+    assert(0 <= i && i < n);
+    return edge_weights[i];
+  }
+  Weight TourWeight() const { return tour_weight; }
+
+  // Calls f with a view of the graph whose distance function is known at compile time (a CoordinateView or a
+  // MatrixView) and returns the result. operator() dispatches on the representation at every call, so hot loops should
+  // be templated on the view type instead. The view is invalidated by any change of the graph.
+  template<class F>
+  decltype(auto) Visit(F &&f) const;
 
   void Permutate(const Permutation &);
   const Permutation &GetPermutation() const;
 
+  EdgeWeightType GetEdgeWeightType() const { return edge_weight_type; }
+
+  // Precomputes the distances between all pairs of nodes into a WeightMatrix, which uses 16-bit weights when they all
+  // fit. The matrix is indexed by the original node ids, so it stays valid after Permutate(). Returns false (and leaves
+  // the graph unchanged) if some distance does not fit in 32 bits.
+  bool BuildDistanceMatrix();
+  // Does nothing for graphs without coordinates, as the matrix is their only representation.
+  void DropDistanceMatrix();
+  bool HasDistanceMatrix() const { return matrix != nullptr; }
+
+  // How the coordinates are stored. All the modes give the same distances, the smaller types reduce memory traffic.
+  enum class Precision { kDouble, kSingle, kInteger };
+
+  // Stores the coordinates as floats. Distances are still computed in double precision, so this is exact iff every
+  // coordinate is representable as a float (e.g. integers up to 2^24). Returns false (and leaves the graph unchanged)
+  // otherwise.
+  bool UseSinglePrecision();
+  // Stores the coordinates as 32-bit integers. Returns false (and leaves the graph
+  // unchanged) unless all the coordinates are integers smaller than kMaxIntegerCoordinate in absolute value. Graphs
+  // read with operator>> or created by Random() use this mode whenever possible.
+  bool UseIntegerCoordinates();
+  void UseDoublePrecision();
+  Precision GetPrecision() const { return precision; }
+
   // Read Graph in TSPLIB format.
   friend std::istream &operator>>(std::istream &, Graph &);
 
-  [[deprecated]] Weight GetWeight(CycleEdge e) const { return Dist(e.id, e.id + 1); }
+  [[deprecated]] Weight GetWeight(CycleEdge e) const { return EdgeWeight(e.id); }
   [[deprecated]] Weight GetWeight(CycleNode u, CycleNode v) const { return Dist(u.id, v.id); }
-  [[deprecated]] Weight CycleWeight() const {
-    Weight weight = 0;
-    for (int i = 0; i < n; ++i)
-      weight += Dist(i, i + 1);
-    return weight;
-  }
+  [[deprecated]] Weight CycleWeight() const { return TourWeight(); }
   [[deprecated]] Weight CycleWeight(const std::vector<CycleNode> &cycle) const {
     Weight weight = GetWeight(cycle[n - 1], cycle[0]);
     for (int i = 1; i < n; ++i)
@@ -68,13 +244,40 @@ class Graph {
   }
 
  private:
-  Weight Dist(int u, int v) const {
-    Point a = points[u], b = points[v];
-    // TSPLIB documentation dictates the use of cast instead of round().
-    // NOLINTNEXTLINE(bugprone-incorrect-roundings)
-    return Weight(std::sqrt((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y)) + 0.5);
+  // Coordinates in the structure-of-arrays layout, with a sentinel: x[n] == x[0] and y[n] == y[0].
+  template<class T>
+  struct Points {
+    std::vector<T> x, y;
+
+    Point operator[](int v) const { return Point{static_cast<double>(x[v]), static_cast<double>(y[v])}; }
+    int Size() const { return static_cast<int>(x.size()); }
+    void Resize(int size) { x.resize(size); y.resize(size); }
+    void Clear() { x.clear(); y.clear(); }
+    void Permutate(const Permutation &);
+  };
+
+  Point Coord(int v) const {
+    switch (precision) {
+      case Precision::kSingle: return points32[v];
+      case Precision::kInteger: return points_int[v];
+      default: return points[v];
+    }
   }
 
+  Weight Dist(int u, int v) const;
+  // Computes edge_weights and tour_weight from scratch.
+  void ComputeEdgeWeights();
+
+  // Calls f(Metric{}, points) with the metric policy of the graph and the stored points.
+  template<class F>
+  decltype(auto) VisitCoordinates(F &&f) const;
+  template<class Metric, class F>
+  decltype(auto) VisitPoints(F &&f) const;
+
+  // Returns the coordinates in double precision, regardless of the current mode.
+  Points<double> DoublePoints() const;
+  void SetPrecision(Precision, const Points<double> &);
+
   int CheckIdx(int idx) const {
     assert(n > 0);
     assert(idx >= 0);
@@ -85,10 +288,67 @@ class Graph {
   void CheckInvariant() const;
 
   int n;
-  std::vector<Point> points;
+  // Only the points matching the current precision are stored, the others are empty.
+  Points<double> points;
+  Points<float> points32;
+  Points<std::int32_t> points_int;
+  Precision precision = Precision::kDouble;
+  EdgeWeightType edge_weight_type = EdgeWeightType::kEuc2d;
   Permutation perm;
+  // Only used with the distance matrix: ids[i] is the original id of the i-th node, with ids[n] == ids[0].
+  std::vector<int> ids;
+  // Shared between copies of the graph, as it never changes once built.
+  std::shared_ptr<const WeightMatrix> matrix;
+  // edge_weights[i] is the weight of the edge (i, i+1) and tour_weight their sum.
+  std::vector<Weight> edge_weights;
+  Weight tour_weight = 0;
 };
 
+template<class F>
+decltype(auto) Graph::Visit(F &&f) const {
+  if (matrix) {
+    if (matrix->Narrow())
+      return f(MatrixView<std::int16_t>(n, matrix->Data16(), ids.data(), edge_weights.data()));
+    return f(MatrixView<std::int32_t>(n, matrix->Data32(), ids.data(), edge_weights.data()));
+  }
+  return VisitCoordinates([&f, this](auto metric, const auto &coords) {
+    using T = typename std::decay_t<decltype(coords.x)>::value_type;
+    return f(CoordinateView<decltype(metric), T>(n, coords.x.data(), coords.y.data(), edge_weights.data()));
+  });
+}
+
+template<class F>
+decltype(auto) Graph::VisitCoordinates(F &&f) const {
+  switch (edge_weight_type) {
+    case EdgeWeightType::kCeil2d: return VisitPoints<Ceil2dMetric>(f);
+    case EdgeWeightType::kAtt: return VisitPoints<AttMetric>(f);
+    case EdgeWeightType::kGeo: return VisitPoints<GeoMetric>(f);
+    case EdgeWeightType::kMan2d: return VisitPoints<Man2dMetric>(f);
+    case EdgeWeightType::kMax2d: return VisitPoints<Max2dMetric>(f);
+    default: return VisitPoints<Euc2dMetric>(f);
+  }
+}
+
+template<class Metric, class F>
+decltype(auto) Graph::VisitPoints(F &&f) const {
+  switch (precision) {
+    case Precision::kSingle: return f(Metric{}, points32);
+    case Precision::kInteger: return f(Metric{}, points_int);
+    default: return f(Metric{}, points);
+  }
+}
+
+inline Weight Graph::Dist(int u, int v) const {
+  return Visit([u, v](const auto &view) { return view(u, v); });
+}
+
+// Reads a graph in TSPLIB format from a file, which is memory-mapped and parsed by up to `threads` threads (see
+// ParseTsplib). Errors in the file are printed and leave the graph empty. If cache is set, the parsed instance is
+// saved to its instance cache (see CachedInstance), which is loaded instead of parsing the file as long as the file
+// does not change. The checksum of the file, which keys the cache, is stored in checksum if given. Returns false if the
+// file cannot be opened.
+bool ReadGraph(const std::string &path, Graph *, int threads = 1, bool cache = true, std::uint64_t *checksum = nullptr);
+
 Weight CycleWeight(const Graph &, const Permutation &cycle);
 
 void WriteGraph(std::ostream *out, const Graph &graph, const std::string &name = "");
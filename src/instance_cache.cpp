@@ -0,0 +1,307 @@
+#include "instance_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <utility>
+
+#include <unistd.h>
+
+#include "mapped_file.h"
+
+namespace kopt {
+namespace {
+
+constexpr char kMagic[8] = {'K', 'O', 'P', 'T', 'I', 'N', 'S', 'T'};
+constexpr std::uint32_t kVersion = 1;
+// Sections start at multiples of this, so that the mapped arrays are aligned.
+constexpr std::size_t kAlignment = 64;
+
+// The file starts with this header, followed by section_count Section entries and the sections themselves, all in the
+// native byte order. header_checksum covers the header (with header_checksum set to 0) and the section table, which
+// holds the checksums of the sections. The checksum of the weights is not verified when loading, so that a large
+// matrix is mapped without being read; partial files are avoided by writing under a temporary name (see WriteFile).
+// The sidecars use the same format with a single section.
+struct FileHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t edge_weight_type;
+  std::int64_t n;
+  std::uint64_t input_checksum;
+  std::uint64_t header_checksum;
+  std::uint32_t section_count;
+  char padding[20];
+};
+static_assert(sizeof(FileHeader) == 64);
+
+enum class SectionKind : std::uint32_t {
+  kX = 1, kY, kWeights, kNeighbors, kTour,
+};
+
+struct Section {
+  SectionKind kind;
+  std::uint32_t width;  // Bytes per element.
+  std::uint64_t offset;
+  std::uint64_t count;
+  std::uint64_t checksum;
+};
+static_assert(sizeof(Section) == 32);
+
+// A section to be written, pointing to the caller's data.
+struct OutputSection {
+  Section section;
+  const void *data;
+};
+
+std::size_t AlignUp(std::size_t offset) {
+  return (offset + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+std::uint64_t HeaderChecksum(FileHeader header, const Section *sections) {
+  header.header_checksum = 0;
+  std::string bytes(reinterpret_cast<const char *>(&header), sizeof(header));
+  bytes.append(reinterpret_cast<const char *>(sections), header.section_count * sizeof(Section));
+  return Checksum(bytes);
+}
+
+std::string_view SectionBytes(const char *data, const Section &section) {
+  return std::string_view(data + section.offset, section.count * section.width);
+}
+
+// Copies a section after verifying its checksum.
+template<class T>
+bool CopySection(const char *data, const Section &section, std::vector<T> *out) {
+  if (Checksum(SectionBytes(data, section)) != section.checksum)
+    return false;
+  const T *begin = reinterpret_cast<const T *>(data + section.offset);
+  out->assign(begin, begin + section.count);
+  return true;
+}
+
+bool AllBelow(const std::vector<std::int32_t> &values, int n) {
+  for (auto value : values)
+    if (value < 0 || value >= n)
+      return false;
+  return true;
+}
+
+// Maps a file written by WriteFile for the input with the given checksum and reads its header and section table.
+// Returns nullptr if the file does not exist, has a different format version or input checksum, or if the header or
+// the bounds of a section are malformed.
+std::shared_ptr<const MappedFile> MapFile(const std::string &path, std::uint64_t checksum, FileHeader *header,
+                                          std::vector<Section> *sections) {
+  std::shared_ptr<const MappedFile> file = MappedFile::Open(path);
+  if (!file || file->Size() < sizeof(FileHeader))
+    return nullptr;
+  std::memcpy(header, file->Data(), sizeof(*header));
+  if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 || header->version != kVersion ||
+      header->input_checksum != checksum)
+    return nullptr;
+  if (header->n < 0 || header->n > std::numeric_limits<int>::max() ||
+      header->edge_weight_type > static_cast<std::uint32_t>(EdgeWeightType::kExplicit) ||
+      header->section_count > (file->Size() - sizeof(FileHeader)) / sizeof(Section))
+    return nullptr;
+  sections->resize(header->section_count);
+  std::memcpy(sections->data(), file->Data() + sizeof(FileHeader), sections->size() * sizeof(Section));
+  if (header->header_checksum != HeaderChecksum(*header, sections->data()))
+    return nullptr;
+  for (auto &section : *sections)
+    if (section.offset % kAlignment != 0 || section.offset > file->Size() || section.width == 0 ||
+        section.count > (file->Size() - section.offset) / section.width)
+      return nullptr;
+  return file;
+}
+
+// Writes the header and the sections under a temporary name and renames it, so that a concurrent load never sees a
+// partial file. Returns false if the file cannot be written.
+bool WriteFile(const std::string &path, std::uint64_t checksum, EdgeWeightType type, int n,
+               std::vector<OutputSection> output) {
+  std::vector<Section> sections;
+  std::size_t offset = sizeof(FileHeader) + output.size() * sizeof(Section);
+  for (auto &out : output) {
+    offset = AlignUp(offset);
+    out.section.offset = offset;
+    offset += out.section.count * out.section.width;
+    sections.emplace_back(out.section);
+  }
+  FileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.edge_weight_type = static_cast<std::uint32_t>(type);
+  header.n = n;
+  header.input_checksum = checksum;
+  header.section_count = static_cast<std::uint32_t>(sections.size());
+  header.header_checksum = HeaderChecksum(header, sections.data());
+
+  // Concurrent writers use distinct temporary files.
+  std::string tmp_path = path + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(sections.data()), std::streamsize(sections.size() * sizeof(Section)));
+    std::size_t at = sizeof(FileHeader) + sections.size() * sizeof(Section);
+    for (auto &out_section : output) {
+      static const char zeros[kAlignment] = {};
+      out.write(zeros, std::streamsize(out_section.section.offset - at));
+      std::size_t size = out_section.section.count * out_section.section.width;
+      out.write(static_cast<const char *>(out_section.data), std::streamsize(size));
+      at = out_section.section.offset + size;
+    }
+    if (!out.flush()) {
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+  }
+  return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+OutputSection MakeSection(SectionKind kind, std::uint32_t width, std::size_t count, const void *data) {
+  auto checksum = Checksum(std::string_view(static_cast<const char *>(data), count * width));
+  return OutputSection{Section{kind, width, 0, count, checksum}, data};
+}
+
+// Loads the 32-bit values of a sidecar holding a section of the given kind, for a graph with n nodes.
+bool LoadSidecar(const std::string &path, std::uint64_t checksum, SectionKind kind, int *n,
+                 std::vector<std::int32_t> *values) {
+  FileHeader header;
+  std::vector<Section> sections;
+  auto file = MapFile(path, checksum, &header, &sections);
+  if (!file || sections.size() != 1 || sections[0].kind != kind || sections[0].width != sizeof(std::int32_t) ||
+      !CopySection(file->Data(), sections[0], values))
+    return false;
+  *n = static_cast<int>(header.n);
+  return true;
+}
+
+bool SaveSidecar(const std::string &path, std::uint64_t checksum, SectionKind kind, int n,
+                 const std::vector<std::int32_t> &values) {
+  // The sidecars do not depend on the type of the weights.
+  return WriteFile(path, checksum, EdgeWeightType::kEuc2d, n,
+                   {MakeSection(kind, sizeof(std::int32_t), values.size(), values.data())});
+}
+
+}  // namespace
+
+std::uint64_t Checksum(std::string_view bytes) {
+  constexpr std::uint64_t kMultiplier = 0x9E3779B97F4A7C15ULL;
+  std::uint64_t hash = bytes.size();
+  auto mix = [&hash](std::uint64_t word) {
+    hash = (hash ^ word) * kMultiplier;
+    hash ^= hash >> 32;
+  };
+  std::size_t i = 0;
+  for (; i + 8 <= bytes.size(); i += 8) {
+    std::uint64_t word;
+    std::memcpy(&word, bytes.data() + i, 8);
+    mix(word);
+  }
+  if (i < bytes.size()) {
+    std::uint64_t tail = 0;
+    std::memcpy(&tail, bytes.data() + i, bytes.size() - i);
+    mix(tail);
+  }
+  return hash;
+}
+
+std::string InstanceCachePath(const std::string &input) {
+  return input + ".kcache";
+}
+
+std::string CachedTourPath(const std::string &input) {
+  return input + ".ktour";
+}
+
+std::string CachedNeighborsPath(const std::string &input) {
+  return input + ".kneighbors";
+}
+
+bool LoadInstanceCache(const std::string &path, std::uint64_t checksum, CachedInstance *instance) {
+  FileHeader header;
+  std::vector<Section> sections;
+  std::shared_ptr<const MappedFile> file = MapFile(path, checksum, &header, &sections);
+  if (!file)
+    return false;
+
+  CachedInstance result;
+  result.type = static_cast<EdgeWeightType>(header.edge_weight_type);
+  result.n = static_cast<int>(header.n);
+  std::size_t n = result.n;
+  for (auto &section : sections) {
+    if (section.kind == SectionKind::kX || section.kind == SectionKind::kY) {
+      if (section.width != sizeof(double) || section.count != n ||
+          !CopySection(file->Data(), section, section.kind == SectionKind::kX ? &result.x : &result.y))
+        return false;
+    } else if (section.kind == SectionKind::kWeights) {
+      if ((section.width != 2 && section.width != 4) || section.count != n * n)
+        return false;
+      result.weights = WeightMatrix::Map(result.n, section.width == 2, file->Data() + section.offset, file);
+    }
+    // Sections of unknown kinds are ignored, as are the neighbor lists and tours of caches written before they moved
+    // to the sidecars.
+  }
+  if (result.type == EdgeWeightType::kExplicit ? !result.weights : result.x.size() != n || result.y.size() != n)
+    return false;
+  *instance = std::move(result);
+  return true;
+}
+
+bool SaveInstanceCache(const std::string &path, std::uint64_t checksum, const CachedInstance &instance) {
+  std::vector<OutputSection> output;
+  auto add = [&output](SectionKind kind, std::uint32_t width, std::size_t count, const void *data) {
+    output.emplace_back(MakeSection(kind, width, count, data));
+  };
+  if (!instance.x.empty()) {
+    add(SectionKind::kX, sizeof(double), instance.x.size(), instance.x.data());
+    add(SectionKind::kY, sizeof(double), instance.y.size(), instance.y.data());
+  }
+  if (instance.weights) {
+    auto &weights = *instance.weights;
+    std::size_t count = std::size_t(weights.N()) * weights.N();
+    if (weights.Narrow())
+      add(SectionKind::kWeights, sizeof(std::int16_t), count, weights.Data16());
+    else
+      add(SectionKind::kWeights, sizeof(std::int32_t), count, weights.Data32());
+  }
+  return WriteFile(path, checksum, instance.type, instance.n, std::move(output));
+}
+
+bool ReadCachedTour(const std::string &input, std::uint64_t checksum, Permutation *tour) {
+  int n;
+  std::vector<std::int32_t> ids;
+  if (!LoadSidecar(CachedTourPath(input), checksum, SectionKind::kTour, &n, &ids) || Size(ids) != n)
+    return false;
+  std::vector<int> order(ids.begin(), ids.end());
+  if (!IsPermutation(order))
+    return false;
+  *tour = Permutation(std::move(order));
+  return true;
+}
+
+bool SaveCachedTour(const std::string &input, std::uint64_t checksum, const Permutation &tour) {
+  std::vector<std::int32_t> ids(tour.N());
+  for (int i = 0; i < tour.N(); ++i)
+    ids[i] = tour[i];
+  return SaveSidecar(CachedTourPath(input), checksum, SectionKind::kTour, tour.N(), ids);
+}
+
+bool ReadCachedNeighbors(const std::string &input, std::uint64_t checksum, int count,
+                         std::vector<std::int32_t> *neighbors) {
+  int n;
+  std::vector<std::int32_t> lists;
+  if (count <= 0 || !LoadSidecar(CachedNeighborsPath(input), checksum, SectionKind::kNeighbors, &n, &lists) ||
+      lists.size() != std::size_t(n) * count || !AllBelow(lists, n))
+    return false;
+  *neighbors = std::move(lists);
+  return true;
+}
+
+bool SaveCachedNeighbors(const std::string &input, std::uint64_t checksum, int count,
+                         const std::vector<std::int32_t> &neighbors) {
+  if (count <= 0 || neighbors.size() % count != 0)
+    return false;
+  int n = static_cast<int>(neighbors.size() / count);
+  return SaveSidecar(CachedNeighborsPath(input), checksum, SectionKind::kNeighbors, n, neighbors);
+}
+
+}  // namespace kopt
@@ -0,0 +1,61 @@
+#ifndef KOPT_SRC_INSTANCE_CACHE_H_
+#define KOPT_SRC_INSTANCE_CACHE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "graph.h"
+#include "permutation.h"
+#include "weight_matrix.h"
+
+namespace kopt {
+
+// The parsed contents of a TSPLIB file, together with data derived from it, as stored in its instance cache. The
+// cache is a versioned binary file written next to the input (see InstanceCachePath) and memory-mapped by later runs,
+// so that the input is parsed only once. It records a checksum of the input and is ignored once the input changes.
+// Data found later for the instance, the best tour and the candidate neighbor lists, is kept in sidecars of the cache:
+// small files of the same format keyed by the same checksum, so that saving it neither reads the input again nor
+// rewrites the cache, which holds the weights of EXPLICIT instances.
+struct CachedInstance {
+  EdgeWeightType type = EdgeWeightType::kEuc2d;
+  int n = 0;
+  // The coordinates in the order of the input, empty for EXPLICIT instances.
+  std::vector<double> x, y;
+  // The weights of EXPLICIT instances, null otherwise. Loaded matrices refer directly to the mapped cache.
+  std::shared_ptr<const WeightMatrix> weights;
+};
+
+// A 64-bit checksum of the bytes, used to recognize the input of a cache.
+std::uint64_t Checksum(std::string_view bytes);
+
+std::string InstanceCachePath(const std::string &input);
+std::string CachedTourPath(const std::string &input);
+std::string CachedNeighborsPath(const std::string &input);
+
+// Loads a cache written by SaveInstanceCache for an input with the given checksum. Returns false if the file does not
+// exist, has a different format version or input checksum, or is malformed.
+bool LoadInstanceCache(const std::string &path, std::uint64_t checksum, CachedInstance *);
+// Writes the cache under a temporary name and renames it, so that a concurrent load never sees a partial file. Returns
+// false if the file cannot be written.
+bool SaveInstanceCache(const std::string &path, std::uint64_t checksum, const CachedInstance &);
+
+// Reads the best tour stored for the TSPLIB file at input, whose contents have the given checksum, by original ids.
+// Returns false if there is none or it is stale.
+bool ReadCachedTour(const std::string &input, std::uint64_t checksum, Permutation *tour);
+// Replaces the best tour stored for the TSPLIB file at input. Returns false if it cannot be written.
+bool SaveCachedTour(const std::string &input, std::uint64_t checksum, const Permutation &tour);
+// Reads the candidate neighbor lists stored for the TSPLIB file at input, whose contents have the given checksum.
+// Returns false if there are none, they are stale or they do not hold count candidates per node.
+bool ReadCachedNeighbors(const std::string &input, std::uint64_t checksum, int count,
+                         std::vector<std::int32_t> *neighbors);
+// Replaces the candidate neighbor lists stored for the TSPLIB file at input, count per node. Returns false if they
+// cannot be written.
+bool SaveCachedNeighbors(const std::string &input, std::uint64_t checksum, int count,
+                         const std::vector<std::int32_t> &neighbors);
+
+}  // namespace kopt
+
+#endif  // KOPT_SRC_INSTANCE_CACHE_H_
@@ -1,18 +1,31 @@
 #include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <random>
+#include <sstream>
 
 #include <gflags/gflags.h>
+#include "checkpoint.h"
 #include "clever_kopt.h"
+#include "construction.h"
 #include "de_berg.h"
 #include "retrieve_solution.h"
 #include "naive_kopt.h"
-#include "gain_func.h"
 #include "slow_embedding.h"
 #include "dynamic.h"
+#include "gain_bound.h"
 #include "new_naive.h"
+#include "instance_cache.h"
+#include "mapped_file.h"
+#include "neighbor_kopt.h"
+#include "pruned_kopt.h"
+#include "spatial_index.h"
+#include "thread_pool.h"
+#include "tsplib.h"
 
 DEFINE_bool(iterate, false, "iterate k-opt");
 DEFINE_int32(k, 0, "the k in k-opt (number of edges in signature)");
@@ -22,18 +35,50 @@ DEFINE_string(input, "", "input file to read (read from stdin if empty)");
 
 DEFINE_string(library, "data/decomposition", "path to decomposition library");
 
-DEFINE_string(algorithm, "", "the algorithm to use");
-DEFINE_string(initial_cycle, "", "the initial cycle to use (identity, shuffle or walk");
+DEFINE_string(algorithm, "",
+              "the algorithm to use (clever, deberg, naive, hardcoded, combined, experimental, neighbor, subset or "
+              "pruned)");
+DEFINE_string(initial_cycle, "",
+              "the initial cycle to use (identity, shuffle, walk, cached, hilbert, greedy, savings, or file:<path> "
+              "for a TSPLIB tour file)");
 DEFINE_bool(shuffle_signatures, false, "shuffle signatures with equal cost");
 DEFINE_int64(deadline, 0, "maximum running time in seconds for global");
 DEFINE_int64(deadline_step, 0, "deadline extension in seconds after each improvement");
+DEFINE_string(checkpoint, "", "file to save the state of --iterate to periodically, on SIGTERM and at the end");
+DEFINE_int32(checkpoint_interval, 60, "seconds between the checkpoints of --iterate");
+DEFINE_bool(resume, false, "resume --iterate from --checkpoint instead of setting the initial cycle");
+DEFINE_string(distance_matrix, "auto", "precompute all distances (always, never or auto)");
+DEFINE_int32(distance_matrix_max_n, 10000, "the largest graph for which --distance_matrix=auto precomputes distances");
+DEFINE_int32(candidates, 10,
+             "the number of candidate neighbors per node for --algorithm=neighbor, --sparse_tables and the greedy and "
+             "savings initial cycles");
+DEFINE_bool(quadrant_candidates, false, "take the candidate neighbors from the four quadrants around each node");
+DEFINE_bool(sparse_tables, false,
+            "let the clever algorithm only add edges between candidate neighbors, keeping sparse tables of such moves");
+DEFINE_bool(lean_tables, false,
+            "let the clever algorithm free the tables it no longer needs and recompute them to retrieve the move, "
+            "trading time for memory");
+DEFINE_int32(threads, 1, "the number of threads of the parallel 2-opt and 3-opt scans");
+DEFINE_int32(input_threads, 1, "the number of threads parsing the coordinates of the input");
+DEFINE_bool(instance_cache, true,
+            "keep the parsed input in a binary file next to the input (<input>.kcache), and the best tour found and "
+            "the candidate neighbor lists in files beside it (<input>.ktour and <input>.kneighbors)");
+DEFINE_bool(single_precision, false,
+            "store non-integer coordinates as floats if it does not change the distances");
+
+// The checksum of --input, which keys its instance cache and the files beside it.
+std::uint64_t input_checksum = 0;
 
 enum class Algorithm {
-  kClever, kDeberg, kNaive, kHardcoded, kCombined, kExperimental,
+  kClever, kDeberg, kNaive, kHardcoded, kCombined, kExperimental, kNeighbor, kSubset, kPruned,
 };
 
 enum class InitialCycle {
-  kIdentity, kShuffle, kWalk,
+  kIdentity, kShuffle, kWalk, kCached, kSpaceFillingCurve, kGreedy, kSavings, kFile,
+};
+
+enum class DistanceMatrix {
+  kAlways, kNever, kAuto,
 };
 
 Algorithm GetAlgorithm() {
@@ -49,6 +94,12 @@ Algorithm GetAlgorithm() {
     return Algorithm::kCombined;
   else if (FLAGS_algorithm == "experimental")
     return Algorithm::kExperimental;
+  else if (FLAGS_algorithm == "neighbor")
+    return Algorithm::kNeighbor;
+  else if (FLAGS_algorithm == "subset")
+    return Algorithm::kSubset;
+  else if (FLAGS_algorithm == "pruned")
+    return Algorithm::kPruned;
   std::cerr << "Invalid flag --algorithm='" << FLAGS_algorithm << "'\n";
   exit(1);
 }
@@ -60,14 +111,60 @@ InitialCycle GetInitialCycle() {
     return InitialCycle::kShuffle;
   else if (FLAGS_initial_cycle == "walk")
     return InitialCycle::kWalk;
+  else if (FLAGS_initial_cycle == "cached")
+    return InitialCycle::kCached;
+  else if (FLAGS_initial_cycle == "hilbert")
+    return InitialCycle::kSpaceFillingCurve;
+  else if (FLAGS_initial_cycle == "greedy")
+    return InitialCycle::kGreedy;
+  else if (FLAGS_initial_cycle == "savings")
+    return InitialCycle::kSavings;
+  else if (FLAGS_initial_cycle.rfind("file:", 0) == 0)
+    return InitialCycle::kFile;
   std::cerr << "Invalid flag --initial-cycle='" << FLAGS_initial_cycle << "'\n";
   exit(1);
 }
 
+DistanceMatrix GetDistanceMatrix() {
+  if (FLAGS_distance_matrix == "always")
+    return DistanceMatrix::kAlways;
+  else if (FLAGS_distance_matrix == "never")
+    return DistanceMatrix::kNever;
+  else if (FLAGS_distance_matrix == "auto")
+    return DistanceMatrix::kAuto;
+  std::cerr << "Invalid flag --distance_matrix='" << FLAGS_distance_matrix << "'\n";
+  exit(1);
+}
+
+void SetDistanceMatrix(kopt::Graph *graph) {
+  auto mode = GetDistanceMatrix();
+  if (mode == DistanceMatrix::kNever)
+    return;
+  if (mode == DistanceMatrix::kAuto && graph->N() > FLAGS_distance_matrix_max_n)
+    return;
+  if (!graph->BuildDistanceMatrix() && mode == DistanceMatrix::kAlways)
+    std::cerr << "Distances do not fit in the distance matrix, computing them on the fly\n";
+}
+
+// The candidate neighbor lists for --algorithm=neighbor, --sparse_tables and the greedy and savings initial cycles.
+// Lists of nearest neighbors are kept beside the instance cache.
+std::shared_ptr<const kopt::NeighborLists> GetNeighborLists(const kopt::Graph &graph) {
+  bool cache = !FLAGS_input.empty() && FLAGS_instance_cache && !FLAGS_quadrant_candidates;
+  int count = std::max(0, std::min(FLAGS_candidates, graph.N() - 1));
+  std::vector<std::int32_t> neighbors;
+  if (cache && count > 0 && kopt::ReadCachedNeighbors(FLAGS_input, input_checksum, count, &neighbors))
+    return std::make_shared<const kopt::NeighborLists>(graph.N(), count, std::move(neighbors));
+  auto lists = kopt::NeighborLists::Build(graph, FLAGS_candidates, FLAGS_quadrant_candidates);
+  if (cache && count > 0 && !kopt::SaveCachedNeighbors(FLAGS_input, input_checksum, count, lists->Data()))
+    std::cerr << "Failed to save the neighbor lists to '" << kopt::CachedNeighborsPath(FLAGS_input) << "'\n";
+  return lists;
+}
+
 std::vector<kopt::CycleNode> Local(int k, const kopt::Graph &graph, const kopt::DecompositionLibrary &library) {
   auto algo = GetAlgorithm();
   if (algo == Algorithm::kClever) {
-    return kopt::LocalClever(k, graph, library);
+    return kopt::LocalClever(k, graph, library, FLAGS_sparse_tables ? GetNeighborLists(graph) : nullptr,
+                             FLAGS_lean_tables);
   } else if (algo == Algorithm::kDeberg) {
     return kopt::LocalDeBerg(k, graph);
   } else if (algo == Algorithm::kNaive) {
@@ -88,12 +185,31 @@ std::vector<kopt::CycleNode> Local(int k, const kopt::Graph &graph, const kopt::
       std::cerr << "No experimental algorithm for k = " << k << '\n';
       std::exit(1);
     }
+  } else if (algo == Algorithm::kNeighbor) {
+    if (k == 2 || k == 3) {
+      return kopt::LocalNeighbor(k, graph, GetNeighborLists(graph));
+    } else {
+      std::cerr << "No neighbor algorithm for k = " << k << '\n';
+      std::exit(1);
+    }
+  } else if (algo == Algorithm::kSubset) {
+    return kopt::LocalSubset(k, graph);
+  } else if (algo == Algorithm::kPruned) {
+    return kopt::LocalPruned(k, graph);
   } else abort();
 }
 
 namespace kopt {
 namespace {
 
+// An improvement of the cycle of the graph, as seen by the other algorithms: its matching and its removed edges (u, v)
+// by original ids, with v following u along the cycle, in cycle order. See NeighborKopt::Apply.
+struct Change {
+  MatchingId matching_id;
+  std::vector<std::pair<int, int>> edges;
+  Weight gain;
+};
+
 struct Algo {
   virtual ~Algo() = default;
   virtual Kmove Run(const Graph &) const = 0;
@@ -101,14 +217,32 @@ struct Algo {
   virtual std::tuple<int, int, int> Cost() const = 0;
   virtual std::string Type() const = 0;
   virtual MatchingId Sig() const = 0;
-  bool Improve(Graph *g) {
+  // Applies an improving move to the graph if there is one, and describes it in change.
+  virtual bool Improve(Graph *g, Change *change) {
     Kmove move = Run(*g);
     if (move.gain > 0) {
+      [[maybe_unused]] Weight weight = g->TourWeight();
+      auto &perm = g->GetPermutation();
+      change->matching_id = move.matching_id;
+      change->gain = move.gain;
+      change->edges.clear();
+      for (auto edge : move.embedding.Domain()) {
+        int position = move.embedding(edge).id;
+        change->edges.emplace_back(perm[position], perm[position + 1 == g->N() ? 0 : position + 1]);
+      }
       g->ApplyPermutation(RetrieveSolution(g->N(), Matching(move.matching_id), move.embedding));
+      assert(g->TourWeight() == weight - move.gain);
       return true;
     }
     return false;
   }
+  // Called after another algorithm improved the cycle of the graph.
+  virtual void Changed(const Change &) {}
+  // Whether Improve only applies the move to a cycle of the algorithm's own, leaving the graph behind until Sync, so
+  // that a run of such moves does not permute the graph after each of them.
+  virtual bool Lazy() const { return false; }
+  // Makes the graph take over the cycle of a lazy algorithm, keeping the node at position 0 in place.
+  virtual void Sync(Graph *) const {}
 };
 
 struct FuncAlgo : public Algo {
@@ -133,41 +267,91 @@ struct NaiveAlgo : public Algo {
   std::string Type() const override { return "naive"; }
   std::tuple<int, int, int> Cost() const override { return {k, 3, 0}; }
   MatchingId Sig() const override { return matching_id; }
-  Kmove Run(const Graph &g) const override {
-    Matching matching(matching_id);
-    GainFunc gain_func(g, matching);
-    Embedding embedding(Len(matching_id) + 1, g.N());
-    do {
-      int64_t gain = gain_func.Join(embedding);
-      if (gain > 0)
-        return Kmove{gain, matching_id, SlowEmbedding(embedding)};
-    } while (embedding.Next());
-    return {};
+  Kmove Run(const Graph &g) const override { return SignatureKopt(matching_id, g, true); }
+
+  int k;
+  MatchingId matching_id;
+};
+
+struct NeighborAlgo : public Algo {
+  NeighborAlgo(int k, const Graph &g, std::shared_ptr<const NeighborLists> neighbors)
+      : k(k), search(k, std::move(neighbors)) {
+    search.Reset(g);
+  }
+  int K() const override { return k; }
+  std::tuple<int, int, int> Cost() const override { return {k, 0, 0}; }
+  std::string Type() const override { return "neighbor"; }
+  MatchingId Sig() const override { return k == 2 ? MatchingId{'#', '2'} : MatchingId{'#', '3'}; }
+  // The move is on the tour of the search, by original ids, so only Improve applies it.
+  Kmove Run(const Graph &) const override { return search.Next(); }
+  // The search keeps its tour and its queue of nodes to look at between calls. The move is only applied to the tour,
+  // which the graph takes over in Sync.
+  bool Improve(Graph *, Change *change) override {
+    Kmove move = search.Next();
+    if (move.gain <= 0)
+      return false;
+    change->matching_id = move.matching_id;
+    change->gain = move.gain;
+    change->edges.clear();
+    for (int i = 0; i < k; ++i) {
+      int v = move.embedding(SigEdge(i)).id;
+      change->edges.emplace_back(v, search.GetTour().Next(v));
+    }
+    search.Apply(move);
+    return true;
+  }
+  void Changed(const Change &change) override { search.Apply(Matching(change.matching_id), change.edges); }
+  bool Lazy() const override { return true; }
+  void Sync(Graph *g) const override {
+    auto &perm = g->GetPermutation();
+    g->Permutate(Compose(Inverse(perm), Permutation(search.GetTour().Order(perm[0]))));
   }
 
+  int k;
+  mutable NeighborKopt search;
+};
+
+struct PrunedAlgo : public Algo {
+  PrunedAlgo(MatchingId id) : k(Len(id) + 1), matching_id(id) {}
+  std::string Type() const override { return "pruned"; }
+  std::tuple<int, int, int> Cost() const override { return {k, 3, 0}; }
+  MatchingId Sig() const override { return matching_id; }
+  Kmove Run(const Graph &g) const override { return PrunedKopt(matching_id, g, true); }
+
   int k;
   MatchingId matching_id;
 };
 
+// All the signatures with k edges, searched together by SubsetKopt.
+struct SubsetAlgo : public Algo {
+  explicit SubsetAlgo(int k) : k(k) {}
+  int K() const override { return k; }
+  std::tuple<int, int, int> Cost() const override { return {k, 3, 0}; }
+  std::string Type() const override { return "subset"; }
+  MatchingId Sig() const override { return MatchingId{'#', static_cast<char>('0' + k)}; }
+  Kmove Run(const Graph &g) const override { return SubsetKopt(k, g, true); }
+
+  int k;
+};
+
 struct CleverAlgo : public Algo {
-  CleverAlgo(MatchingId id, const Decomposition *d, int n)
-      : matching_id(id), decomposition(d), tw(decomposition->TreeWidth()), constant(decomposition->Constant(n)) {}
+  CleverAlgo(MatchingId id, const Decomposition *d, int n, std::shared_ptr<const NeighborLists> candidates = nullptr)
+      : matching_id(id), decomposition(d), tw(decomposition->TreeWidth()), constant(decomposition->Constant(n)),
+        candidates(std::move(candidates)) {}
   std::string Type() const override { return "clever"; }
   std::tuple<int, int, int> Cost() const override { return {tw + 1, 2, constant}; }
   MatchingId Sig() const override { return matching_id; }
   Kmove Run(const Graph &g) const override {
-    Matching matching(matching_id);
-    auto result = decomposition->Dfs(Dynamic(g.N(), GainFunc(g, matching)));
-    if (result->table[0] > 0)
-      return Kmove{result->table[0], matching_id, RetrieveEmbedding(result, g.N())};
-    else
-      return Kmove{};
+    return DynamicKopt(*decomposition, matching_id, g,
+                       candidates ? std::make_shared<const CandidateGraph>(g, *candidates) : nullptr,
+                       FLAGS_lean_tables);
   }
 
   MatchingId matching_id;
   const Decomposition *decomposition;
   int tw;
   int constant;
+  std::shared_ptr<const NeighborLists> candidates;  // Set for --sparse_tables.
 };
 
 struct DeBergAlgo : public Algo {
@@ -183,15 +367,18 @@ struct DeBergAlgo : public Algo {
   int exp;
 };
 
-std::unique_ptr<Algo> ChooseAlgo(int n, const Matching &m, const DecompositionLibrary &lib) {
+std::unique_ptr<Algo> ChooseAlgo(int n, const Matching &m, const DecompositionLibrary &lib,
+                                 const std::shared_ptr<const NeighborLists> &candidates) {
   if (FLAGS_algorithm == "naive") {
     return std::make_unique<NaiveAlgo>(m.Id());
+  } else if (FLAGS_algorithm == "pruned") {
+    return std::make_unique<PrunedAlgo>(m.Id());
   } else if (FLAGS_algorithm == "clever") {
-    return std::make_unique<CleverAlgo>(m.Id(), &lib[DependenceGraph(m)], n);
+    return std::make_unique<CleverAlgo>(m.Id(), &lib[DependenceGraph(m)], n, candidates);
   } else if (FLAGS_algorithm == "deberg") {
     return std::make_unique<DeBergAlgo>(m.Id());
   } else if (FLAGS_algorithm == "combined") {
-    auto clever = std::make_unique<CleverAlgo>(m.Id(), &lib[DependenceGraph(m)], n);
+    auto clever = std::make_unique<CleverAlgo>(m.Id(), &lib[DependenceGraph(m)], n, candidates);
     auto deberg = std::make_unique<DeBergAlgo>(m.Id());
     if (clever->Cost() < deberg->Cost())
       return clever;
@@ -204,15 +391,39 @@ void PrintCost(std::ostream &stream, const std::tuple<int, int, int> &t) {
   stream << '(' << std::get<0>(t) << ", " << std::get<1>(t) << ", " << std::get<2>(t) << ')';
 }
 
-std::vector<std::unique_ptr<Algo>> PrepareSignatures(int n, const DecompositionLibrary &library) {
+std::vector<std::unique_ptr<Algo>> PrepareSignatures(const Graph &graph, const DecompositionLibrary &library) {
   using Ptr = std::unique_ptr<Algo>;
   std::vector<Ptr> sig;
-  sig.emplace_back(new FuncAlgo(&Naive2optBase, "hardcoded", 2, MatchingId{'#', '2'}));
-  sig.emplace_back(new FuncAlgo(&Naive3optBase, "hardcoded", 3, MatchingId{'#', '3'}));
+  int n = graph.N();
+  // Only 2-opt and 3-opt have candidate-restricted engines; the other signatures would scan all the edges again.
+  if (GetAlgorithm() == Algorithm::kNeighbor) {
+    auto neighbors = GetNeighborLists(graph);
+    sig.emplace_back(new NeighborAlgo(2, graph, neighbors));
+    sig.emplace_back(new NeighborAlgo(3, graph, neighbors));
+    return sig;
+  }
+  // Sparse tables are meant for graphs too large for the full scans of the hardcoded 2-opt and 3-opt, so they are
+  // restricted to candidate neighbors as well.
+  std::shared_ptr<const NeighborLists> candidates;
+  if (FLAGS_sparse_tables) {
+    candidates = GetNeighborLists(graph);
+    sig.emplace_back(new NeighborAlgo(2, graph, candidates));
+    sig.emplace_back(new NeighborAlgo(3, graph, candidates));
+  } else {
+    sig.emplace_back(new FuncAlgo(&Naive2optBase, "hardcoded", 2, MatchingId{'#', '2'}));
+    sig.emplace_back(new FuncAlgo(&Naive3optBase, "hardcoded", 3, MatchingId{'#', '3'}));
+  }
+  // A subset scan cannot stop at the deadline, and the one of all the 25828 signatures with 7 edges takes hours
+  // already on graphs of a few dozen nodes, so it goes up to k = 5 only.
+  if (GetAlgorithm() == Algorithm::kSubset) {
+    sig.emplace_back(new SubsetAlgo(4));
+    sig.emplace_back(new SubsetAlgo(5));
+    return sig;
+  }
   for (int k = 4; k <= 7; ++k) {
     Matching matching(k);
     while (matching.NextIrreducible())
-      sig.emplace_back(ChooseAlgo(n, matching, library));
+      sig.emplace_back(ChooseAlgo(n, matching, library, candidates));
   }
   constexpr auto cmp = [](const Ptr &l, const Ptr &r) {
     return l->Cost() < r->Cost();
@@ -232,31 +443,65 @@ std::vector<std::unique_ptr<Algo>> PrepareSignatures(int n, const DecompositionL
   return sig;
 }
 
+// Starts at a random node and moves to one of the 5 nearest unvisited nodes until all are visited. Graphs with
+// coordinates find them with a KdTree, EXPLICIT graphs by scanning all the nodes.
 void GenerateWalk(Graph *graph) {
   auto &engine = Rng();
   auto rand = [&](int a) { return std::uniform_int_distribution<>(0, a - 1)(engine); };
+  constexpr int kChoices = 5;
 
   int n = graph->N();
-  CycleNode at(rand(n) + 1);
+  if (n == 0)
+    return;
+  CycleNode at(rand(n));
   std::vector<bool> visited(n);
   std::vector<CycleNode> cycle{at};
+  std::unique_ptr<KdTree> tree;
+  if (graph->HasCoordinates())
+    tree = std::make_unique<KdTree>(*graph);
+  struct Candidate { int64_t dist; CycleNode v; };
+  std::vector<Candidate> candidates;
+  std::vector<int> nearest;
   while (Size(cycle) < n) {
     visited[at.id] = true;
-    struct Candidate { int64_t dist; CycleNode v; };
-    std::vector<Candidate> candidates;
-    for (int i = 0; i < n; ++i) {
-      auto dist = graph->GetWeight(at, CycleNode(i));
-      if (!visited[i]) candidates.emplace_back(Candidate{dist, CycleNode(i)});
+    candidates.clear();
+    if (tree) {
+      tree->Remove(at.id);
+      tree->Nearest((*graph)[at.id], kChoices, &nearest);
+      for (int v : nearest)
+        candidates.emplace_back(Candidate{graph->GetWeight(at, CycleNode(v)), CycleNode(v)});
+    } else {
+      for (int i = 0; i < n; ++i) {
+        auto dist = graph->GetWeight(at, CycleNode(i));
+        if (!visited[i]) candidates.emplace_back(Candidate{dist, CycleNode(i)});
+      }
     }
     constexpr auto cmp = [](const Candidate &l, const Candidate &r) { return l.dist < r.dist; };
-    std::sort(candidates.begin(), candidates.end(), cmp);
-    at = candidates[rand(std::min(Size(candidates), 5))].v;
+    std::stable_sort(candidates.begin(), candidates.end(), cmp);
+    at = candidates[rand(std::min(Size(candidates), kChoices))].v;
     cycle.emplace_back(at);
   }
 
   graph->ApplyPermutation(cycle);
 }
 
+// Starts from the tour in a TSPLIB tour file, exiting if it cannot be read or is not a tour of the graph.
+void ReadInitialTour(const std::string &path, Graph *graph) {
+  auto file = MappedFile::Open(path);
+  if (!file) {
+    std::cerr << "Failed to open '" << path << "'\n";
+    exit(1);
+  }
+  std::vector<int> tour;
+  std::string error;
+  if (!ParseTour(file->View(), graph->N(), &tour, &error)) {
+    std::cerr << "Invalid tour '" << path << "': " << error << '\n';
+    exit(1);
+  }
+  // The file lists original ids, the graph is permutated by positions.
+  graph->Permutate(Compose(Inverse(graph->GetPermutation()), Permutation(std::move(tour))));
+}
+
 void SetInitialCycle(Graph *graph) {
   auto cycle = GetInitialCycle();
   if (cycle == InitialCycle::kIdentity) {
@@ -265,33 +510,191 @@ void SetInitialCycle(Graph *graph) {
     graph->RandomShuffle();
   } else if (cycle == InitialCycle::kWalk) {
     GenerateWalk(graph);
+  } else if (cycle == InitialCycle::kCached) {
+    Permutation tour;
+    if (!FLAGS_input.empty() && FLAGS_instance_cache && ReadCachedTour(FLAGS_input, input_checksum, &tour))
+      graph->ApplyPermutation(ToIds(tour.Vec()));
+    else
+      std::cerr << "No cached tour for the input, starting from the identity\n";
+  } else if (cycle == InitialCycle::kSpaceFillingCurve) {
+    if (!graph->HasCoordinates()) {
+      std::cerr << "--initial_cycle=hilbert requires coordinates\n";
+      exit(1);
+    }
+    graph->Permutate(SpaceFillingCurveTour(*graph));
+  } else if (cycle == InitialCycle::kGreedy) {
+    graph->Permutate(GreedyEdgeTour(*graph, *GetNeighborLists(*graph)));
+  } else if (cycle == InitialCycle::kSavings) {
+    graph->Permutate(SavingsTour(*graph, *GetNeighborLists(*graph)));
+  } else if (cycle == InitialCycle::kFile) {
+    ReadInitialTour(FLAGS_initial_cycle.substr(5), graph);
   } else abort();
 }
 
+// Keeps the best tour found for the input beside its instance cache, for --initial_cycle=cached.
+void SaveBestTour(const Graph &graph, const std::vector<CycleNode> &solution) {
+  if (FLAGS_input.empty() || !FLAGS_instance_cache)
+    return;
+  Permutation tour(ToInts(solution)), cached;
+  if (ReadCachedTour(FLAGS_input, input_checksum, &cached) && CycleWeight(graph, cached) <= CycleWeight(graph, tour))
+    return;
+  if (!SaveCachedTour(FLAGS_input, input_checksum, tour))
+    std::cerr << "Failed to save the tour to '" << CachedTourPath(FLAGS_input) << "'\n";
+}
+
 void PrintHeader() {
   std::cout << "time,weight,k,method,exponent,signature\n";
 }
 
+using Wall = std::chrono::steady_clock;
+const Wall::time_point start_time = Wall::now();
+
+// The wall time since the start, in clock() ticks. CPU time would add up the time of all the --threads.
+clock_t WallClock() {
+  return std::chrono::duration_cast<std::chrono::duration<clock_t, std::ratio<1, CLOCKS_PER_SEC>>>(
+      Wall::now() - start_time).count();
+}
+
+// The time used by the search, including the time used before it was resumed from a checkpoint.
+clock_t clock_offset = 0;
+clock_t Elapsed() { return WallClock() + clock_offset; }
+
+// The rows before and after setting the initial cycle, with k 0 and the name of the cycle as the method, so that the
+// difference of their times is the time spent constructing it.
+void PrintInitialCycle(int64_t weight, const std::string &name) {
+  std::cout << Elapsed() << ',' << weight << ",0," << name << ",0,\n";
+}
+
 void PrintStep(int64_t weight, const Algo &algo) {
-  std::cout << clock() << ',' << weight;
+  std::cout << Elapsed() << ',' << weight;
   std::cout << ',' << algo.K() << ',' << algo.Type() << ',' << std::get<0>(algo.Cost()) << ',' << algo.Sig() << '\n';
 }
 
+// Restores the cycle, the time used and Rng() from --checkpoint, exiting if it cannot be read or belongs to another
+// instance or configuration. The signatures must then be prepared again, which leaves Rng() as it was at the
+// checkpoint.
+Checkpoint Resume(Graph *graph) {
+  Checkpoint checkpoint;
+  std::string error;
+  if (!LoadCheckpoint(FLAGS_checkpoint, &checkpoint, &error)) {
+    std::cerr << "Invalid checkpoint '" << FLAGS_checkpoint << "': " << error << '\n';
+    exit(1);
+  }
+  if (checkpoint.n != graph->N() || checkpoint.input_checksum != input_checksum ||
+      checkpoint.algorithm != FLAGS_algorithm) {
+    std::cerr << "The checkpoint '" << FLAGS_checkpoint << "' is for another graph or --algorithm\n";
+    exit(1);
+  }
+  auto check = [](bool same, const char *flag) {
+    if (!same) {
+      std::cerr << "The checkpoint '" << FLAGS_checkpoint << "' was written with another --" << flag << '\n';
+      exit(1);
+    }
+  };
+  check(checkpoint.shuffle_signatures == FLAGS_shuffle_signatures, "shuffle_signatures");
+  check(checkpoint.sparse_tables == FLAGS_sparse_tables, "sparse_tables");
+  check(checkpoint.candidates == FLAGS_candidates, "candidates");
+  check(checkpoint.quadrant_candidates == FLAGS_quadrant_candidates, "quadrant_candidates");
+  graph->Permutate(Compose(Inverse(graph->GetPermutation()), Permutation(checkpoint.tour)));
+  clock_offset = checkpoint.clock - WallClock();
+  std::istringstream(checkpoint.rng) >> Rng();
+  return checkpoint;
+}
+
 std::vector<CycleNode> GenericGlobal(Graph *graph, const DecompositionLibrary &library) {
-  SetInitialCycle(graph);
-  auto signatures = PrepareSignatures(graph->N(), library);
-  auto it = signatures.begin();
   PrintHeader();
-  clock_t deadline = (FLAGS_deadline ? FLAGS_deadline : FLAGS_deadline_step) * CLOCKS_PER_SEC;
-  while (it < signatures.end() && clock() < deadline) {
-    if ((*it)->Improve(graph)) {
-      PrintStep(graph->CycleWeight(), **it);
+  PrintInitialCycle(graph->TourWeight(), "input");
+  Checkpoint checkpoint;
+  if (FLAGS_resume) {
+    checkpoint = Resume(graph);
+    PrintInitialCycle(graph->TourWeight(), "resume");
+  } else {
+    SetInitialCycle(graph);
+    PrintInitialCycle(graph->TourWeight(), FLAGS_initial_cycle.substr(0, FLAGS_initial_cycle.find(':')));
+    std::ostringstream rng;
+    rng << Rng();
+    checkpoint.rng = rng.str();
+  }
+  auto signatures = PrepareSignatures(*graph, library);
+  if (FLAGS_resume && checkpoint.signature_count != Size(signatures)) {
+    std::cerr << "The checkpoint '" << FLAGS_checkpoint << "' was written with other signatures\n";
+    exit(1);
+  }
+  auto it = signatures.begin() + checkpoint.cursor;
+  clock_t deadline = FLAGS_resume ? checkpoint.deadline
+                                  : (FLAGS_deadline ? FLAGS_deadline : FLAGS_deadline_step) * CLOCKS_PER_SEC;
+
+  // The state of the search, with the current tour only if with_tour.
+  auto state = [&](bool with_tour) {
+    Checkpoint state;
+    state.n = graph->N();
+    state.input_checksum = input_checksum;
+    state.algorithm = FLAGS_algorithm;
+    state.signature_count = Size(signatures);
+    state.shuffle_signatures = FLAGS_shuffle_signatures;
+    state.sparse_tables = FLAGS_sparse_tables;
+    state.candidates = FLAGS_candidates;
+    state.quadrant_candidates = FLAGS_quadrant_candidates;
+    state.cursor = static_cast<int>(it - signatures.begin());
+    state.clock = Elapsed();
+    state.deadline = deadline;
+    state.rng = checkpoint.rng;
+    if (with_tour)
+      state.tour = ToInts(graph->GetPermutationIds());
+    return state;
+  };
+  // The writer stops the search on SIGTERM, after writing the state handed over before the current signature.
+  CheckpointWriter writer(FLAGS_checkpoint, std::chrono::seconds(FLAGS_checkpoint_interval));
+  writer.Update(state(true));
+  GainBound bound(*graph);
+  Change change;
+  Weight weight = graph->TourWeight();
+  // The lazy algorithm whose cycle is ahead of the graph, if any. The state is only handed over without one.
+  const Algo *ahead = nullptr;
+  auto sync = [&]() {
+    if (ahead) {
+      ahead->Sync(graph);
+      ahead = nullptr;
+      assert(graph->TourWeight() == weight);
+    }
+  };
+  while (it < signatures.end() && Elapsed() < deadline && !writer.Terminated()) {
+    if (bound.Hopeless((*it)->Sig())) {
+      // Skipped signatures are cheap to check again, so the cursor is only handed over after searched ones.
+      ++it;
+      continue;
+    }
+    if (!(*it)->Lazy())
+      sync();
+    if ((*it)->Improve(graph, &change)) {
+      weight -= change.gain;
+      PrintStep(weight, **it);
+      if ((*it)->Lazy())
+        ahead = it->get();
+      for (auto &other : signatures)
+        if (other != *it)
+          other->Changed(change);
+      // The node at position 0 stays in place until the graph takes over the cycle of a lazy algorithm.
+      bound.Update(Matching(change.matching_id), change.edges, graph->GetPermutation()[0]);
       it = signatures.begin();
-      deadline = std::max(deadline, clock() + FLAGS_deadline_step * CLOCKS_PER_SEC);
+      deadline = std::max(deadline, Elapsed() + FLAGS_deadline_step * CLOCKS_PER_SEC);
+      if (!ahead)
+        writer.Update(state(true));
     } else {
       ++it;
+      if (!ahead)
+        writer.Update(state(false));
+    }
+    // A run of lazy moves only brings the graph up to date when the writer has not had a new state for an interval.
+    if (ahead && writer.Stale()) {
+      sync();
+      writer.Update(state(true));
     }
   }
+  sync();
+  writer.Finish(state(true));
+  if (writer.Terminated())
+    std::cerr << "Terminated, stopping the search\n";
   auto result = graph->GetPermutationIds();
   graph->ResetPermutation();
   return result;
@@ -313,19 +716,31 @@ int main(int argc, char **argv) {
     std::cerr << "The value of k must be in range [2, 7]\n";
     return 1;
   }
+  if (FLAGS_resume && FLAGS_checkpoint.empty()) {
+    std::cerr << "--resume requires --checkpoint\n";
+    return 1;
+  }
+  // Only the thread of the CheckpointWriter of --iterate receives SIGTERM.
+  if (FLAGS_iterate)
+    BlockTermination();
+  SetWorkers(FLAGS_threads);
 
   Graph graph;
   if (FLAGS_input.empty()) {
     std::cin >> graph;
-  } else {
-    std::ifstream input(FLAGS_input);
-    if (input) {
-      input >> graph;
-    } else {
-      std::cerr << "Failed to open '" << FLAGS_input << "'\n";
-      return 1;
-    }
+  } else if (!ReadGraph(FLAGS_input, &graph, FLAGS_input_threads, FLAGS_instance_cache, &input_checksum)) {
+    std::cerr << "Failed to open '" << FLAGS_input << "'\n";
+    return 1;
+  }
+  if (graph.N() == 0) {
+    std::cerr << "No graph read from the input\n";
+    return 1;
   }
+  // Integer coordinates are already stored compactly.
+  if (FLAGS_single_precision && graph.HasCoordinates() && graph.GetPrecision() == kopt::Graph::Precision::kDouble &&
+      !graph.UseSinglePrecision())
+    std::cerr << "Coordinates are not representable as floats, keeping double precision\n";
+  SetDistanceMatrix(&graph);
 
   DecompositionLibrary library;
   for (int i = 2; i <= 7; ++i)
@@ -334,11 +749,14 @@ int main(int argc, char **argv) {
   std::vector<CycleNode> solution;
   if (FLAGS_iterate) {
     solution = GenericGlobal(&graph, library);
+    SaveBestTour(graph, solution);
   } else {
     std::vector<Permutation> tours;
     for (int k = FLAGS_min_k; k <= FLAGS_max_k; ++k)
       tours.emplace_back(Permutation(ToInts(Local(k, graph, library))));
     WriteTours(&std::cout, tours);
   }
+  if (SkippedSignatures())
+    std::cerr << "Skipped " << SkippedSignatures() << " signatures whose gain bound is not positive\n";
   return 0;
 }
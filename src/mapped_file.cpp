@@ -0,0 +1,39 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace kopt {
+
+std::unique_ptr<MappedFile> MappedFile::Open(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+  std::unique_ptr<MappedFile> file(new MappedFile());
+  struct stat st{};
+  bool ok = fstat(fd, &st) == 0;
+  // An empty file cannot be mapped, it is represented by a null pointer.
+  if (ok && st.st_size > 0) {
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      ok = false;
+    } else {
+      file->data_ = data;
+      file->size_ = st.st_size;
+    }
+  }
+  // The mapping stays valid after closing the descriptor.
+  close(fd);
+  if (!ok)
+    return nullptr;
+  return file;
+}
+
+MappedFile::~MappedFile() {
+  if (data_)
+    munmap(data_, size_);
+}
+
+}  // namespace kopt
@@ -0,0 +1,34 @@
+#ifndef KOPT_SRC_MAPPED_FILE_H_
+#define KOPT_SRC_MAPPED_FILE_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace kopt {
+
+// A read-only memory mapping of a whole file.
+class MappedFile {
+ public:
+  // Returns nullptr if the file cannot be opened or mapped.
+  static std::unique_ptr<MappedFile> Open(const std::string &path);
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile();
+
+  const char *Data() const { return static_cast<const char *>(data_); }
+  std::size_t Size() const { return size_; }
+  std::string_view View() const { return std::string_view(Data(), size_); }
+
+ private:
+  MappedFile() = default;
+
+  void *data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+}  // namespace kopt
+
+#endif  // KOPT_SRC_MAPPED_FILE_H_
@@ -1,29 +1,81 @@
 #include <naive_kopt.h>
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 #include <gain_func.h>
 #include <fast_embedding.h>
 #include <matching.h>
 #include <retrieve_solution.h>
+#include <thread_pool.h>
 
 namespace kopt {
 
+namespace {
+
+// The number of ranges of rows per thread, so that threads which finish early take over the work of the others.
+constexpr int kChunksPerThread = 8;
+// Scans of fewer pairs or triples than this are not worth waking the workers for.
+constexpr double kMinParallelWork = 1 << 18;
+
+// Splits the rows of a scan whose row i costs work(i) into ranges for the threads of Workers().
+std::vector<int> ScanChunks(int rows, const std::function<double(int)> &work) {
+  int threads = Workers().Threads();
+  double total = 0;
+  for (int i = 0; i < rows; ++i)
+    total += work(i);
+  return BalancedChunks(rows, threads == 1 || total < kMinParallelWork ? 1 : threads * kChunksPerThread, work);
+}
+
+}  // namespace
+
+// The rows i are split into ranges scanned in parallel, each keeping the first best move in its range. The best of
+// those, again the first one in case of ties, is the move a single thread would find, whatever the number of threads.
 Kmove Naive2optBase(const Graph &g) {
-  int64_t best_gain = std::numeric_limits<int64_t>::min();
-  CycleEdge best_i, best_j;
-  for (CycleEdge i(0); i.id < g.N(); ++i.id) {
-    for (CycleEdge j(i.id + 1); j.id < g.N(); ++j.id) {
-      int64_t gain = g.GetWeight(i) + g.GetWeight(j) - g.GetWeight(i.Left(), j.Left()) - g.GetWeight(i.Right(), j.Right());
-      if (gain > best_gain) {
-        best_gain = gain;
-        best_i = i;
-        best_j = j;
+  int n = g.N();
+  std::vector<Weight> edge(n);
+  for (int i = 0; i < n; ++i)
+    edge[i] = g.EdgeWeight(i);
+  struct Best {
+    int64_t gain = std::numeric_limits<int64_t>::min();
+    int i = 0, j = 0;
+  };
+  auto bounds = ScanChunks(n - 1, [n](int i) { return double(n - i); });
+  std::vector<Best> chunk_best(bounds.size() - 1);
+  Workers().Run(Size(chunk_best), [&](int chunk) {
+    // For a fixed i: left[j] = g(i, j) and right[j] = g(i+1, j+1).
+    std::vector<Weight> left(n), right(n), gain(n);
+    Best &best = chunk_best[chunk];
+    for (int i = bounds[chunk]; i < bounds[chunk + 1]; ++i) {
+      g.Distances(i, i + 1, n, &left[i + 1]);
+      g.Distances(i + 1, i + 2, n + 1, &right[i + 1]);
+      int64_t row_best = std::numeric_limits<int64_t>::min();
+      for (int j = i + 1; j < n; ++j) {
+        gain[j] = edge[i] + edge[j] - left[j] - right[j];
+        row_best = std::max(row_best, gain[j]);
       }
+      if (row_best > best.gain)
+        best = {row_best, i, int(std::find(gain.begin() + i + 1, gain.end(), row_best) - gain.begin())};
     }
-  }
+  });
+  Best best;
+  for (auto &chunk : chunk_best)
+    if (chunk.gain > best.gain) best = chunk;
   SlowEmbedding e(g.N());
-  e.SetVal(SigEdge(0), best_i);
-  e.SetVal(SigEdge(1), best_j);
-  return Kmove{best_gain, {'a'}, e};
+  e.SetVal(SigEdge(0), CycleEdge(best.i));
+  e.SetVal(SigEdge(1), CycleEdge(best.j));
+  return Kmove{best.gain, {'a'}, e};
 }
 
 std::vector<CycleNode> Naive2opt(const Graph &g) {
@@ -51,26 +103,35 @@ static std::vector<CycleNode> retrieve(int n, int type, int i, int j, int k) {
   return sol;
 }
 
-Kmove Naive3optBase(const Graph &g) {
-  int n = g.N();
+// The costs of the four pure 3-opt reconnections of edges i < j < k.
+static std::array<int64_t, 4> Naive3optCosts(const Graph &g, int i, int j, int k) {
+  return {
+      g(i, j+1) + g(k, i+1) + g(j, k+1),
+      g(i, k) + g(j+1, i+1) + g(j, k+1),
+      g(j, i) + g(k+1, j+1) + g(k, i+1),
+      g(k, j) + g(i+1, k+1) + g(i, j+1),
+  };
+}
 
-  struct {
-    int64_t gain, type, i, j, k;
-  } best{};
-  best.gain = 0;
-  for (int i = 0; i < n; ++i) for (int j = i+1; j < n; ++j) for (int k = j+1; k < n; ++k) {
-    int64_t cost[4] = {
-        g(i, j+1) + g(k, i+1) + g(j, k+1),
-        g(i, k) + g(j+1, i+1) + g(j, k+1),
-        g(j, i) + g(k+1, j+1) + g(k, i+1),
-        g(k, j) + g(i+1, k+1) + g(i, j+1),
-    };
-    int type = 0;
+namespace {
+
+// The best move of a 3-opt scan: the largest positive gain, and among the moves with that gain, the first (i, j, k) in
+// lexicographic order.
+struct Best3opt {
+  int64_t gain, type, i, j, k;
+
+  bool IsBetter(int64_t other_gain, int64_t other_i, int64_t other_j, int64_t other_k) const {
+    return other_gain > gain ||
+        (other_gain == gain && gain > 0 && std::tie(other_i, other_j, other_k) < std::tie(i, j, k));
+  }
+};
+
+// Picks the cheapest reconnection of the best edges (the first in case of a tie) and builds the move.
+Kmove Naive3optMove(const Graph &g, Best3opt best) {
+  if (best.gain > 0) {
+    auto cost = Naive3optCosts(g, int(best.i), int(best.j), int(best.k));
     for (int l = 1; l < 4; ++l)
-      if (cost[l] < cost[type]) type = l;
-    int gain = g(i, i+1) + g(j, j+1) + g(k, k+1) - cost[type];
-    if (gain > best.gain)
-      best = {gain, type, i, j, k};
+      if (cost[l] < cost[best.type]) best.type = l;
   }
 
   MatchingId id;
@@ -87,6 +148,190 @@ Kmove Naive3optBase(const Graph &g) {
   return Kmove{best.gain, id, e};
 }
 
+// The edges j and k are scanned in square tiles of this size. The distances of a tile from the nodes j and j+1 take
+// 2 * kTile * (kTile + 1) weights (66 KB), which stay in L2 while all the rows i pass over the tile.
+constexpr int kTile = 64;
+
+// The inputs of the gains of the moves (i, j, k) for a pair i < j and a range of k. The pointers are offset so that
+// index t stands for k = begin + t: pi[t] = g(i, k), pi1[t] = g(i+1, k), pj[t] = g(j, k), pj1[t] = g(j+1, k) and
+// edge[t] = g(k, k+1). All but edge are also read at t + 1.
+struct TripleRow {
+  const Weight *pi, *pi1, *pj, *pj1, *edge;
+  Weight a, b, c;  // g(i, j+1), g(i+1, j+1) and g(j, i), which do not depend on k.
+  Weight removed;  // g(i, i+1) + g(j, j+1).
+};
+
+// The gain of the cheapest of the four pure reconnections for index t, as in Naive3optCosts.
+inline Weight TripleGain(const TripleRow &r, int t) {
+  Weight cost = std::min(std::min(r.a + r.pi1[t] + r.pj[t + 1], r.pi[t] + r.b + r.pj[t + 1]),
+                         std::min(r.c + r.pj1[t + 1] + r.pi1[t], r.pj[t] + r.pi1[t + 1] + r.a));
+  return r.removed + r.edge[t] - cost;
+}
+
+using RowBestKernel = Weight (*)(const TripleRow &, int count);
+
+// The largest gain for t in [0, count).
+Weight RowBestScalar(const TripleRow &r, int count) {
+  Weight best = std::numeric_limits<Weight>::min();
+  for (int t = 0; t < count; ++t)
+    best = std::max(best, TripleGain(r, t));
+  return best;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2")))
+inline __m256i Load(const Weight *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)); }
+
+__attribute__((target("avx2")))
+inline __m256i Min(__m256i x, __m256i y) { return _mm256_blendv_epi8(x, y, _mm256_cmpgt_epi64(x, y)); }
+
+__attribute__((target("avx2")))
+inline __m256i Max(__m256i x, __m256i y) { return _mm256_blendv_epi8(y, x, _mm256_cmpgt_epi64(x, y)); }
+
+// Evaluates the four reconnections of four consecutive k in the 64-bit lanes, with the same additions as TripleGain.
+__attribute__((target("avx2")))
+Weight RowBestAvx2(const TripleRow &r, int count) {
+  const __m256i a = _mm256_set1_epi64x(r.a), b = _mm256_set1_epi64x(r.b), c = _mm256_set1_epi64x(r.c);
+  const __m256i removed = _mm256_set1_epi64x(r.removed);
+  __m256i best = _mm256_set1_epi64x(std::numeric_limits<Weight>::min());
+  int t = 0;
+  for (; t + 4 <= count; t += 4) {
+    __m256i pi = Load(r.pi + t), pi1 = Load(r.pi1 + t), pi1_next = Load(r.pi1 + t + 1);
+    __m256i pj = Load(r.pj + t), pj_next = Load(r.pj + t + 1), pj1_next = Load(r.pj1 + t + 1);
+    __m256i cost0 = _mm256_add_epi64(_mm256_add_epi64(a, pi1), pj_next);
+    __m256i cost1 = _mm256_add_epi64(_mm256_add_epi64(pi, b), pj_next);
+    __m256i cost2 = _mm256_add_epi64(_mm256_add_epi64(c, pj1_next), pi1);
+    __m256i cost3 = _mm256_add_epi64(_mm256_add_epi64(pj, pi1_next), a);
+    __m256i cost = Min(Min(cost0, cost1), Min(cost2, cost3));
+    best = Max(best, _mm256_sub_epi64(_mm256_add_epi64(removed, Load(r.edge + t)), cost));
+  }
+  alignas(32) Weight lanes[4];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), best);
+  Weight result = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+  for (; t < count; ++t)
+    result = std::max(result, TripleGain(r, t));
+  return result;
+}
+
+RowBestKernel ChooseRowBestKernel() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return &RowBestAvx2;
+  return &RowBestScalar;
+}
+
+#else
+
+RowBestKernel ChooseRowBestKernel() {
+  return &RowBestScalar;
+}
+
+#endif
+
+}  // namespace
+
+// Parallel over ranges of i as Naive2optBase. Within a range, the pairs (j, k) are visited in tiles: the distances from
+// j and j+1 to the k of a tile are computed once per tile and range, and those from i and i+1 once per tile and i,
+// instead of once per pair (i, j). The k of a pair (i, j) in a tile are evaluated four at a time where AVX2 is
+// available.
+Kmove Naive3optBase(const Graph &g) {
+  int n = g.N();
+  static const RowBestKernel kernel = ChooseRowBestKernel();
+  std::vector<Weight> edge(n + 1);
+  for (int i = 0; i < n; ++i)
+    edge[i] = g.EdgeWeight(i);
+  auto bounds = ScanChunks(std::max(n - 2, 0), [n](int i) { return double(n - i) * (n - i) / 2; });
+  std::vector<Best3opt> chunk_best(bounds.size() - 1, Best3opt{});
+  Workers().Run(Size(chunk_best), [&](int chunk) {
+    constexpr int kStride = kTile + 1;
+    // For the current tile: tile_j[(j - j0) * kStride + (k - k0)] = g(j, k), tile_j1 the same for j+1, row_i[k - k0] =
+    // g(i, k), row_i1 the same for i+1, and for the j of the tile, i_to_j[j - j0] = g(i, j) and i1_to_j1[j - j0] =
+    // g(i+1, j+1).
+    std::vector<Weight> tile_j(kTile * kStride), tile_j1(kTile * kStride), row_i(kStride), row_i1(kStride);
+    std::vector<Weight> i_to_j(kTile + 1), i1_to_j1(kTile);
+    Best3opt &best = chunk_best[chunk];
+    int begin = bounds[chunk], end = bounds[chunk + 1];
+    for (int j0 = begin + 1; j0 + 1 < n; j0 += kTile) {
+      int j1 = std::min(j0 + kTile, n - 1);
+      for (int k0 = j0 + 1; k0 < n; k0 += kTile) {
+        int k1 = std::min(k0 + kTile, n);
+        for (int j = j0; j < j1; ++j) {
+          g.Distances(j, k0, k1 + 1, &tile_j[(j - j0) * kStride]);
+          g.Distances(j + 1, k0, k1 + 1, &tile_j1[(j - j0) * kStride]);
+        }
+        for (int i = begin; i < std::min(end, j1 - 1); ++i) {
+          g.Distances(i, k0, k1 + 1, row_i.data());
+          g.Distances(i + 1, k0, k1 + 1, row_i1.data());
+          g.Distances(i, j0, j1 + 1, i_to_j.data());
+          g.Distances(i + 1, j0 + 1, j1 + 1, i1_to_j1.data());
+          for (int j = std::max(j0, i + 1); j < j1; ++j) {
+            int first = std::max(k0, j + 1);
+            if (first >= k1)
+              break;
+            int offset = first - k0;
+            TripleRow row{row_i.data() + offset, row_i1.data() + offset, &tile_j[(j - j0) * kStride + offset],
+                          &tile_j1[(j - j0) * kStride + offset], edge.data() + first,
+                          i_to_j[j + 1 - j0], i1_to_j1[j - j0], i_to_j[j - j0], edge[i] + edge[j]};
+            Weight row_best = kernel(row, k1 - first);
+            if (row_best <= 0 || row_best < best.gain)
+              continue;
+            int t = 0;
+            while (TripleGain(row, t) != row_best) ++t;
+            if (best.IsBetter(row_best, i, j, first + t))
+              best = {row_best, 0, i, j, first + t};
+          }
+        }
+      }
+    }
+  });
+  Best3opt best{};
+  for (auto &chunk : chunk_best)
+    if (best.IsBetter(chunk.gain, chunk.i, chunk.j, chunk.k)) best = chunk;
+  return Naive3optMove(g, best);
+}
+
+// The scan of Naive3optBase before it was tiled: the distances from j and j+1 are computed again for every i.
+Kmove Naive3optRowsBase(const Graph &g) {
+  int n = g.N();
+  std::vector<Weight> edge(n);
+  for (int i = 0; i < n; ++i)
+    edge[i] = g.EdgeWeight(i);
+  auto bounds = ScanChunks(std::max(n - 2, 0), [n](int i) { return double(n - i) * (n - i) / 2; });
+  std::vector<Best3opt> chunk_best(bounds.size() - 1, Best3opt{});
+  Workers().Run(Size(chunk_best), [&](int chunk) {
+    // The distances from i, i+1, j and j+1 to all the later nodes, computed once per row instead of once per triple.
+    std::vector<Weight> row_i(n + 1), row_i1(n + 1), row_j(n + 1), row_j1(n + 1), gain(n);
+    Best3opt &best = chunk_best[chunk];
+    for (int i = bounds[chunk]; i < bounds[chunk + 1]; ++i) {
+      g.Distances(i, i + 1, n + 1, &row_i[i + 1]);
+      g.Distances(i + 1, i + 2, n + 1, &row_i1[i + 2]);
+      for (int j = i + 1; j + 1 < n; ++j) {
+        g.Distances(j, j + 1, n + 1, &row_j[j + 1]);
+        g.Distances(j + 1, j + 2, n + 1, &row_j1[j + 2]);
+        // g(i, j+1), g(j+1, i+1) and g(j, i) do not depend on k.
+        int64_t a = row_i[j + 1], b = row_i1[j + 1], c = row_i[j];
+        int64_t removed = edge[i] + edge[j];
+        int64_t row_best = 0;
+        for (int k = j + 1; k < n; ++k) {
+          int64_t cost = std::min(std::min(a + row_i1[k] + row_j[k + 1], row_i[k] + b + row_j[k + 1]),
+                                  std::min(c + row_j1[k + 1] + row_i1[k], row_j[k] + row_i1[k + 1] + a));
+          gain[k] = removed + edge[k] - cost;
+          row_best = std::max(row_best, gain[k]);
+        }
+        if (row_best > best.gain) {
+          int k = int(std::find(gain.begin() + j + 1, gain.end(), row_best) - gain.begin());
+          best = {row_best, 0, i, j, k};
+        }
+      }
+    }
+  });
+  Best3opt best{};
+  for (auto &chunk : chunk_best)
+    if (chunk.gain > best.gain) best = chunk;
+  return Naive3optMove(g, best);
+}
+
 std::vector<CycleNode> Naive3opt(const Graph &g) {
   auto result = Naive3optBase(g);
   return RetrieveSolution(g.N(), Matching(result.matching_id), result.embedding);
@@ -105,21 +350,59 @@ struct TemplateSubset {
     int i = 0;
     for (i = 0; i < k && v[i] + 1 == v[i + 1]; ++i)
       v[i] = i;
+    lo = 0;
     if (i < k) {
       ++id;
       ++v[i];
+      hi = i;
       return true;
     } else {
       id = 0;
+      hi = k - 1;
       return false;
     }
   }
 
+  // Moves to the next subset in the revolving-door order (Knuth's Algorithm R, TAOCP 7.2.1.3), in which consecutive
+  // subsets differ by a single edge. At most two positions of the sorted edges change: the sets {1, 2, 4} and {2, 3,
+  // 4} differ by one edge, but in the first two positions.
+  bool NextRevolving() {
+    int n = v[k];
+    int j = 1;
+    if (k % 2 == 1 ? v[0] + 1 < v[1] : v[0] > 0) {
+      v[0] += k % 2 == 1 ? 1 : -1;
+      lo = hi = 0;
+      ++id;
+      return true;
+    }
+    // Alternately tries to decrease and to increase v[j], starting with the move v[0] could not make.
+    bool decrease = k % 2 == 1;
+    for (; j < k && n > k; ++j, decrease = !decrease) {
+      if (decrease && v[j] >= j + 1) {
+        v[j] = v[j - 1];
+        v[j - 1] = j - 1;
+      } else if (!decrease && v[j] + 1 < v[j + 1]) {
+        v[j - 1] = v[j];
+        ++v[j];
+      } else {
+        continue;
+      }
+      lo = j - 1;
+      hi = j;
+      ++id;
+      return true;
+    }
+    *this = TemplateSubset(n);
+    return false;
+  }
+
   int Id() const { return id; }
   int MapEndpoint(int x) const { return v[x / 2] + x % 2; }
   int operator[](int idx) const { return v[idx]; }
 
   int v[k + 1], id{};
+  // The positions [lo, hi] of the edges changed by the last call of Next or NextRevolving; all of them at first.
+  int lo = 0, hi = k - 1;
 };
 
 struct Edge {
@@ -129,16 +412,16 @@ struct Edge {
 template<int k>
 using SignatureEdges = std::array<Edge, k>;
 
-template<int k>
-int64_t RemovedWeight(const Graph &graph, const TemplateSubset<k> &subset) {
+template<int k, class G>
+int64_t RemovedWeight(const G &graph, const TemplateSubset<k> &subset) {
   int64_t weight = 0;
   for (int i = 0; i < k; ++i)
-    weight += graph(subset[i], subset[i] + 1);
+    weight += graph.EdgeWeight(subset[i]);
   return weight;
 }
 
-template<int k>
-int64_t AddedWeight(const Graph &graph, const SignatureEdges<k> &sig, const TemplateSubset<k> &subset) {
+template<int k, class G>
+int64_t AddedWeight(const G &graph, const SignatureEdges<k> &sig, const TemplateSubset<k> &subset) {
   int64_t weight = 0;
   for (auto &edge : sig)
     weight += graph(subset.MapEndpoint(edge.x), subset.MapEndpoint(edge.y));
@@ -153,8 +436,8 @@ struct KoptResult {
   bool operator<(const KoptResult &right) const { return gain < right.gain; }
 };
 
-template<int k>
-KoptResult kopt(const std::vector<SignatureEdges<k>> &signatures, const Graph &graph) {
+template<int k, class G>
+KoptResult kopt(const std::vector<SignatureEdges<k>> &signatures, const G &graph) {
   TemplateSubset<k> subset(graph.N());
   KoptResult result;
   do {
@@ -175,8 +458,316 @@ std::vector<CycleNode> Experimental3opt(const Graph &g) {
       {Edge{0, 2}, {1, 4}, {3, 5}},
       {Edge{0, 3}, {1, 5}, {2, 4}},
   };
-  auto result = kopt<3>(signatures, g);
+  auto result = g.Visit([&signatures](const auto &view) { return kopt<3>(signatures, view); });
   return retrieve(g.N(), result.signature, result.i, result.j, result.k);
 }
 
+// === Specialized naive k-opt ===
+
+namespace {
+
+// A constexpr copy of the enumeration of Matching (see Matching::Next and Matching::UpdateMatching).
+template<int k>
+struct ConstexprMatching {
+  // Plain arrays, which are much cheaper than std::array for the compiler to evaluate.
+  int matching[2 * k]{}, p[k - 1]{}, o[k - 1]{};
+
+  constexpr ConstexprMatching() {
+    for (int i = 0; i < k - 1; ++i)
+      p[i] = i;
+    Update();
+  }
+
+  constexpr void Update() {
+    for (int i = 0; i < k; ++i) {
+      int a = i == 0 ? 0 : 2 * p[i - 1] + 2 - o[i - 1];
+      int b = i == k - 1 ? 2 * k - 1 : 2 * p[i] + 1 + o[i];
+      matching[a] = b;
+      matching[b] = a;
+    }
+  }
+
+  constexpr bool Reducible() const {
+    for (int i = 0; i < k; ++i)
+      if (matching[2 * i] == 2 * i + 1) return true;
+    return false;
+  }
+
+  constexpr bool Next() {
+    int size = k - 1, i = size - 1;
+    for (; i >= 0; --i) {
+      o[i] = 1 - o[i];
+      if (o[i]) break;
+      else if (i + 1 < size && p[i] < p[i + 1]) {
+        int low = size - 1;
+        while (p[i] >= p[low]) --low;
+        int tmp = p[i];
+        p[i] = p[low];
+        p[low] = tmp;
+        break;
+      }
+    }
+    for (int l = i + 1, r = size - 1; l < r; ++l, --r) {
+      int tmp = p[l];
+      p[l] = p[r];
+      p[r] = tmp;
+    }
+    Update();
+    return i >= 0;
+  }
+
+  constexpr bool NextIrreducible() {
+    while (Next()) {
+      if (!Reducible()) return true;
+    }
+    return false;
+  }
+
+  constexpr MatchingId Id() const {
+    MatchingId id{};
+    for (int i = 0; i < k - 1; ++i)
+      id[i] = static_cast<char>((o[i] ? 'a' : 'A') + p[i]);
+    return id;
+  }
+};
+
+// The number of irreducible signatures with k edges.
+constexpr int kIrreducibleCount[] = {0, 0, 1, 4, 25, 208, 2121, 25828};
+
+// An irreducible signature with its added edges, as pairs of signature nodes x < y.
+template<int k>
+struct Signature {
+  MatchingId id;
+  SignatureEdges<k> edges;
+};
+
+template<int k>
+using SignatureTable = std::array<Signature<k>, kIrreducibleCount[k]>;
+
+// The irreducible signatures in the order of Matching::NextIrreducible.
+template<int k>
+constexpr SignatureTable<k> IrreducibleSignatures() {
+  SignatureTable<k> signatures{};
+  ConstexprMatching<k> matching;
+  int s = 0;
+  for (; matching.NextIrreducible(); ++s) {
+    signatures[s].id = matching.Id();
+    for (int x = 0, e = 0; x < 2 * k; ++x)
+      if (x < matching.matching[x]) signatures[s].edges[e++] = Edge{x, matching.matching[x]};
+  }
+  assert(s == kIrreducibleCount[k]);
+  return signatures;
+}
+
+// The tables up to k = 6 are computed by the compiler. Enumerating the 46080 matchings of k = 7 exceeds its default
+// constexpr limits, so that table is computed by the same code when first used.
+template<int k>
+const SignatureTable<k> &Signatures() {
+  if constexpr (k <= 6) {
+    static constexpr SignatureTable<k> signatures = IrreducibleSignatures<k>();
+    return signatures;
+  } else {
+    static const SignatureTable<k> signatures = IrreducibleSignatures<k>();
+    return signatures;
+  }
+}
+
+// The gain of the embedding of a signature, kept up to date as the subset moves: only the removed edges at the changed
+// positions and the added edges with an endpoint on them are weighed again, i.e. one or two of each for most subsets.
+template<int k, class G>
+struct IncrementalGain {
+  IncrementalGain(const G &graph, const SignatureEdges<k> &edges) : graph(graph), edges(edges) {}
+
+  int64_t Update(const TemplateSubset<k> &subset) {
+    for (int i = subset.lo; i <= subset.hi; ++i) {
+      int64_t weight = graph.EdgeWeight(subset[i]);
+      gain += weight - removed[i];
+      removed[i] = weight;
+    }
+    for (int e = 0; e < k; ++e) {
+      int x = edges[e].x / 2, y = edges[e].y / 2;
+      if ((subset.lo <= x && x <= subset.hi) || (subset.lo <= y && y <= subset.hi)) {
+        int64_t weight = graph(subset.MapEndpoint(edges[e].x), subset.MapEndpoint(edges[e].y));
+        gain -= weight - added[e];
+        added[e] = weight;
+      }
+    }
+    return gain;
+  }
+
+  const G &graph;
+  const SignatureEdges<k> &edges;
+  int64_t gain = 0;
+  // The weights of the removed edges by position and of the added edges, as in gain.
+  std::array<int64_t, k> removed{}, added{};
+};
+
+template<int k, class G>
+Kmove ScanSignature(const G &graph, const Signature<k> &signature, bool first_improvement, bool revolving_door) {
+  int n = graph.N();
+  if (n < k)
+    return Kmove{};
+  TemplateSubset<k> subset(n), best_subset(n);
+  IncrementalGain<k, G> gain(graph, signature.edges);
+  int64_t best_gain = 0;
+  do {
+    if (gain.Update(subset) > best_gain) {
+      best_gain = gain.gain;
+      best_subset = subset;
+      if (first_improvement) break;
+    }
+  } while (revolving_door ? subset.NextRevolving() : subset.Next());
+  if (best_gain <= 0)
+    return Kmove{};
+  SlowEmbedding embedding(n);
+  for (int i = 0; i < k; ++i)
+    embedding.SetVal(SigEdge(i), CycleEdge(best_subset[i]));
+  return Kmove{best_gain, signature.id, embedding};
+}
+
+template<int k>
+const Signature<k> &FindSignature(MatchingId id) {
+  auto &signatures = Signatures<k>();
+  // The positions of the signatures in the table, sorted by id.
+  static const std::vector<int> by_id = [&signatures] {
+    std::vector<int> order = Sequence(Size(signatures));
+    std::sort(order.begin(), order.end(), [&](int l, int r) { return signatures[l].id < signatures[r].id; });
+    return order;
+  }();
+  auto position = std::lower_bound(by_id.begin(), by_id.end(), id,
+                                   [&](int l, const MatchingId &r) { return signatures[l].id < r; });
+  assert(position != by_id.end() && signatures[*position].id == id);
+  return signatures[*position];
+}
+
+template<int k>
+Kmove ScanSignature(MatchingId id, const Graph &graph, bool first_improvement, bool revolving_door) {
+  auto &signature = FindSignature<k>(id);
+  return graph.Visit([&](const auto &view) {
+    return ScanSignature<k>(view, signature, first_improvement, revolving_door);
+  });
+}
+
+// The gain of an embedding as a nested sum over the positions v[k-1] > ... > v[0] of the removed edges, with v[k-1]
+// in the outer loop. Each term is added in the loop of the lowest position it depends on, so partial[i] is the sum of
+// the terms not depending on v[0], ..., v[i-1]. The inner loop is then left with the removed edge v[0] and the two
+// added edges at its endpoints, whose other endpoints are fixed: a whole row of v[0] is one pass over the edge weights
+// and two rows of distances, which Graph::Distances computes with SIMD. The other distances are taken from the view G.
+template<int k, class G>
+class HoistedScan {
+ public:
+  HoistedScan(const Graph &graph, const G &view, const Signature<k> &signature, bool first_improvement)
+      : graph_(graph), view_(view), signature_(signature), first_improvement_(first_improvement), n_(graph.N()),
+        edge_(n_), to_front_(n_), to_back_(n_) {
+    for (int i = 0; i < n_; ++i)
+      edge_[i] = view.EdgeWeight(i);
+    for (auto &edge : signature.edges) {
+      // Irreducible signatures never join the two endpoints of a removed edge.
+      assert(edge.x / 2 < edge.y / 2);
+      if (edge.x / 2 == 0)
+        (edge.x == 0 ? front_partner_ : back_partner_) = edge.y;
+      else
+        level_[edge.x / 2][level_size_[edge.x / 2]++] = edge;
+    }
+  }
+
+  Kmove Run() {
+    if (n_ < k)
+      return Kmove{};
+    v_[k] = n_;
+    partial_[k] = 0;
+    Loop(k - 1);
+    if (best_gain_ <= 0)
+      return Kmove{};
+    SlowEmbedding embedding(n_);
+    for (int i = 0; i < k; ++i)
+      embedding.SetVal(SigEdge(i), CycleEdge(best_[i]));
+    return Kmove{best_gain_, signature_.id, embedding};
+  }
+
+ private:
+  int MapEndpoint(int x) const { return v_[x / 2] + x % 2; }
+
+  // Runs the loop of v[i], for i >= 1. Returns true once the search is done.
+  bool Loop(int i) {
+    for (v_[i] = i; v_[i] < v_[i + 1]; ++v_[i]) {
+      int64_t partial = partial_[i + 1] + edge_[v_[i]];
+      for (int e = 0; e < level_size_[i]; ++e)
+        partial -= view_(MapEndpoint(level_[i][e].x), MapEndpoint(level_[i][e].y));
+      partial_[i] = partial;
+      if (i == 1 ? Row() : Loop(i - 1))
+        return true;
+    }
+    return false;
+  }
+
+  // The loop of v[0] over [0, v[1]), in which the endpoints v[0] and v[0] + 1 are joined to fixed nodes.
+  bool Row() {
+    int count = v_[1];
+    graph_.Distances(MapEndpoint(front_partner_), 0, count, to_front_.data());
+    graph_.Distances(MapEndpoint(back_partner_), 1, count + 1, to_back_.data());
+    int64_t partial = partial_[1];
+    for (int v0 = 0; v0 < count; ++v0) {
+      int64_t gain = partial + edge_[v0] - to_front_[v0] - to_back_[v0];
+      if (gain > best_gain_) {
+        best_gain_ = gain;
+        best_ = v_;
+        best_[0] = v0;
+        if (first_improvement_)
+          return true;
+      }
+    }
+    return false;
+  }
+
+  const Graph &graph_;
+  const G &view_;
+  const Signature<k> &signature_;
+  bool first_improvement_;
+  int n_;
+  std::vector<Weight> edge_, to_front_, to_back_;
+  // The added edges whose lowest endpoint is on the removed edge i > 0, and the other endpoints of the added edges
+  // at the endpoints 0 and 1 of the removed edge 0.
+  std::array<std::array<Edge, 2>, k> level_{};
+  std::array<int, k> level_size_{};
+  int front_partner_ = -1, back_partner_ = -1;
+  std::array<int, k + 1> v_{}, best_{};
+  std::array<int64_t, k + 1> partial_{};
+  int64_t best_gain_ = 0;
+};
+
+template<int k>
+Kmove HoistedSignature(MatchingId id, const Graph &graph, bool first_improvement) {
+  auto &signature = FindSignature<k>(id);
+  return graph.Visit([&](const auto &view) {
+    return HoistedScan<k, std::decay_t<decltype(view)>>(graph, view, signature, first_improvement).Run();
+  });
+}
+
+}  // namespace
+
+Kmove SignatureKopt(MatchingId id, const Graph &graph, bool first_improvement) {
+  switch (Len(id) + 1) {
+    case 2: return HoistedSignature<2>(id, graph, first_improvement);
+    case 3: return HoistedSignature<3>(id, graph, first_improvement);
+    case 4: return HoistedSignature<4>(id, graph, first_improvement);
+    case 5: return HoistedSignature<5>(id, graph, first_improvement);
+    case 6: return HoistedSignature<6>(id, graph, first_improvement);
+    case 7: return HoistedSignature<7>(id, graph, first_improvement);
+    default: abort();
+  }
+}
+
+Kmove IncrementalKopt(MatchingId id, const Graph &graph, bool first_improvement, bool revolving_door) {
+  switch (Len(id) + 1) {
+    case 2: return ScanSignature<2>(id, graph, first_improvement, revolving_door);
+    case 3: return ScanSignature<3>(id, graph, first_improvement, revolving_door);
+    case 4: return ScanSignature<4>(id, graph, first_improvement, revolving_door);
+    case 5: return ScanSignature<5>(id, graph, first_improvement, revolving_door);
+    case 6: return ScanSignature<6>(id, graph, first_improvement, revolving_door);
+    case 7: return ScanSignature<7>(id, graph, first_improvement, revolving_door);
+    default: abort();
+  }
+}
+
 }  // namespace kopt
@@ -16,6 +16,19 @@ std::vector<CycleNode> Experimental3opt(const Graph &g);
 
 Kmove Naive2optBase(const Graph &);
 Kmove Naive3optBase(const Graph &);
+// The same moves as Naive3optBase, found by its previous, untiled scan, the baseline of the tiled one in the benchmark.
+Kmove Naive3optRowsBase(const Graph &);
+
+// Scans all the embeddings of an irreducible signature with 2 to 7 edges, in the order of Embedding::Next. The code is
+// specialized for every k at compile time: the signatures come from a constexpr copy of Matching::NextIrreducible,
+// and the nested loops over the removed edges add each term of the gain in the outermost loop it is fixed in, so that
+// the innermost loop scans whole rows of distances. With first_improvement, returns the first move with a positive
+// gain, otherwise the first move with the largest gain; a move with gain 0 if none improves.
+Kmove SignatureKopt(MatchingId, const Graph &, bool first_improvement);
+// The same search one embedding at a time, updating the gain from the previous embedding by weighing again only the
+// edges which changed. Finds the same moves as SignatureKopt, or scans in revolving-door order with revolving_door,
+// which the benchmark compares against the nested loops of SignatureKopt.
+Kmove IncrementalKopt(MatchingId, const Graph &, bool first_improvement, bool revolving_door = false);
 
 }  // namespace kopt
 
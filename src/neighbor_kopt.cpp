@@ -0,0 +1,180 @@
+#include "neighbor_kopt.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <utility>
+
+#include "matching.h"
+#include "permutation.h"
+
+namespace kopt {
+namespace {
+
+// Sorts the first count elements by insertion, for the at most 3 edges of a move.
+template<class T, std::size_t size>
+void SortPrefix(std::array<T, size> *values, int count) {
+  auto &a = *values;
+  for (int i = 1; i < count; ++i)
+    for (int j = i; j > 0 && a[j] < a[j - 1]; --j)
+      std::swap(a[j], a[j - 1]);
+}
+
+}  // namespace
+
+NeighborKopt::NeighborKopt(int k, std::shared_ptr<const NeighborLists> neighbors)
+    : k_(k), neighbors_(std::move(neighbors)), t_(2 * k), edges_(k) {
+  assert(2 <= k && k <= 3);
+  Matching matching(k);
+  while (matching.NextIrreducible()) {
+    Reconnection reconnection{matching.Id(), {}};
+    for (int i = 0; i < 2 * k; ++i)
+      if (i < matching(SigNode(i)).id)
+        reconnection.added.emplace_back(SigNode(i), matching(SigNode(i)));
+    reconnections_.emplace_back(std::move(reconnection));
+  }
+}
+
+void NeighborKopt::Reset(const Graph &graph) {
+  int n = graph.N();
+  assert(neighbors_->N() == n);
+  graph_ = graph;
+  graph_.Permutate(Inverse(graph.GetPermutation()));
+  auto &perm = graph.GetPermutation();
+  std::vector<int> order(n);
+  for (int v = 0; v < n; ++v)
+    order[v] = perm[v];
+  tour_ = Tour(order);
+  queue_.clear();
+  queued_.assign(n, false);
+  for (int v = 0; v < n; ++v)
+    Enqueue(v);
+}
+
+void NeighborKopt::Apply(const Kmove &move) {
+  std::vector<std::pair<int, int>> edges;
+  for (int i = 0; i < k_; ++i) {
+    int v = move.embedding(SigEdge(i)).id;
+    edges.emplace_back(v, tour_.Next(v));
+  }
+  Apply(Matching(move.matching_id), edges);
+}
+
+void NeighborKopt::Apply(const Matching &matching, const std::vector<std::pair<int, int>> &edges) {
+  SlowEmbedding embedding(tour_.N());
+  for (int i = 0; i < Size(edges); ++i) {
+    assert(tour_.Next(edges[i].first) == edges[i].second);
+    embedding.SetVal(SigEdge(i), CycleEdge(edges[i].first));
+  }
+  tour_.Apply(matching, embedding);
+  for (auto [u, v] : edges) {
+    Enqueue(u);
+    Enqueue(v);
+  }
+}
+
+void NeighborKopt::Enqueue(int v) {
+  if (!queued_[v]) {
+    queued_[v] = true;
+    queue_.emplace_back(v);
+  }
+}
+
+Kmove NeighborKopt::Next() {
+  return graph_.Visit([&](const auto &view) {
+    Kmove move;
+    while (!queue_.empty()) {
+      int v = queue_.front();
+      t_[0] = v;
+      if (Extend(view, 0, 0, &move))
+        return move;
+      queue_.pop_front();
+      queued_[v] = false;
+    }
+    return Kmove{};
+  });
+}
+
+template<class G>
+bool NeighborKopt::Extend(const G &graph, int level, Weight gain, Kmove *move) {
+  int a = t_[2 * level];
+  for (int side = 0; side < 2; ++side) {
+    int b = side ? tour_.Prev(a) : tour_.Next(a);
+    int edge = side ? b : a;
+    if (std::find(edges_.begin(), edges_.begin() + level, edge) != edges_.begin() + level)
+      continue;
+    t_[2 * level + 1] = b;
+    edges_[level] = edge;
+    Weight removed = gain + graph(a, b);
+    if (level + 1 == k_) {
+      if (b != t_[0] && removed - graph(b, t_[0]) > 0 && Close(removed - graph(b, t_[0]), move))
+        return true;
+      continue;
+    }
+    const std::int32_t *candidates = (*neighbors_)[b];
+    for (int i = 0; i < neighbors_->K(); ++i) {
+      int c = candidates[i];
+      Weight partial = removed - graph(b, c);
+      // The candidates are sorted by weight, so the partial gains of the rest are not positive either.
+      if (partial <= 0)
+        break;
+      t_[2 * level + 2] = c;
+      if (Extend(graph, level + 1, partial, move))
+        return true;
+    }
+  }
+  return false;
+}
+
+bool NeighborKopt::Close(Weight gain, Kmove *move) {
+  // The removed edges in the order of the tour, starting from the first one.
+  std::array<int, 3> edges{};
+  std::copy(edges_.begin(), edges_.end(), edges.begin());
+  for (int i = 0; i < k_; ++i)
+    for (int j = i + 1; j < k_; ++j)
+      if (edges[i] == edges[j])
+        return false;
+  if (k_ == 3 && !tour_.Between(edges[0], edges[1], edges[2]))
+    std::swap(edges[1], edges[2]);
+
+  auto key = [](int u, int v) { return u < v ? std::make_pair(u, v) : std::make_pair(v, u); };
+  std::array<std::pair<int, int>, 3> added;
+  for (int i = 0; i < k_; ++i)
+    added[i] = key(t_[2 * i + 1], t_[(2 * i + 2) % (2 * k_)]);
+  SortPrefix(&added, k_);
+  auto endpoint = [&](SigNode node) {
+    int edge = edges[node.Edge().id];
+    return node.IsLeft() ? edge : tour_.Next(edge);
+  };
+  for (auto &reconnection : reconnections_) {
+    std::array<std::pair<int, int>, 3> expected;
+    for (int i = 0; i < k_; ++i)
+      expected[i] = key(endpoint(reconnection.added[i].first), endpoint(reconnection.added[i].second));
+    SortPrefix(&expected, k_);
+    if (!std::equal(added.begin(), added.begin() + k_, expected.begin()))
+      continue;
+    SlowEmbedding embedding(tour_.N());
+    for (int i = 0; i < k_; ++i)
+      embedding.SetVal(SigEdge(i), CycleEdge(edges[i]));
+    *move = Kmove{gain, reconnection.id, embedding};
+    return true;
+  }
+  return false;
+}
+
+std::vector<CycleNode> LocalNeighbor(int k, const Graph &graph, std::shared_ptr<const NeighborLists> neighbors) {
+  NeighborKopt search(k, std::move(neighbors));
+  search.Reset(graph);
+  auto move = search.Next();
+  if (move.gain <= 0)
+    return IdentityCycle(graph.N());
+  search.Apply(move);
+  // The new cycle as positions on the current one, starting from position 0.
+  auto positions = Inverse(graph.GetPermutation());
+  std::vector<CycleNode> cycle;
+  for (int v : search.GetTour().Order(graph.GetPermutation()[0]))
+    cycle.emplace_back(positions[v]);
+  return cycle;
+}
+
+}  // namespace kopt
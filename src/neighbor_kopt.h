@@ -0,0 +1,78 @@
+#ifndef KOPT_SRC_NEIGHBOR_KOPT_H_
+#define KOPT_SRC_NEIGHBOR_KOPT_H_
+
+#include <deque>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "graph.h"
+#include "identifier.h"
+#include "slow_embedding.h"
+#include "spatial_index.h"
+#include "tour.h"
+
+namespace kopt {
+
+// First-improvement 2-opt or 3-opt for large graphs. Instead of scanning all O(n^k) sets of removed edges, it grows
+// moves from a node t1 as in Lin-Kernighan: it removes a cycle edge (t1, t2), adds an edge from t2 to one of its
+// candidate neighbors t3, removes a cycle edge (t3, t4), and so on, as long as the partial gain stays positive, until
+// it closes the move with the edge (t2k, t1). Only the moves replacing all k removed edges, the irreducible matchings
+// also used by the other engines ('a' for k = 2, and 'BA', 'bA', 'ab' and 'Ba' for k = 3), are returned.
+//
+// The search keeps its own cycle as a Tour on the original ids, so that applying a move takes O(k sqrt n) time. The
+// nodes to start from are kept in a queue with don't-look bits: a node leaves the queue once no improving move starts
+// from it and enters it again once one of its cycle edges changes.
+class NeighborKopt {
+ public:
+  NeighborKopt(int k, std::shared_ptr<const NeighborLists>);
+
+  // Starts the search on the current cycle of the graph, with every node in the queue.
+  void Reset(const Graph &);
+  // Returns an improving move of the tour, or a move with gain 0 once there is none among the moves searched. The
+  // embedding maps each removed edge to the original id of the node it leaves, as Tour::Apply expects.
+  Kmove Next();
+  // Applies a move returned by Next to the tour and queues the endpoints of its removed edges.
+  void Apply(const Kmove &);
+  // Applies a move found by other means, e.g. by another engine on the graph, given by its matching and its removed
+  // edges (u, v) by original ids, with v = Next(u) on the tour, in cycle order starting from the first one. A graph
+  // that took over the cycle of the tour runs in the same direction after RetrieveSolution, which keeps the last path
+  // in place as Tour::Apply does.
+  void Apply(const Matching &, const std::vector<std::pair<int, int>> &edges);
+  const Tour &GetTour() const { return tour_; }
+
+ private:
+  // The added edges of an irreducible matching, as pairs of endpoints of removed edges.
+  struct Reconnection {
+    MatchingId id;
+    std::vector<std::pair<SigNode, SigNode>> added;
+  };
+
+  // Given the first 2 * level + 1 nodes t_[0], ..., t_[2 * level] of a move and the weight of the edges removed
+  // minus the weight of the edges added so far, tries to extend it to an improving move. G is a view of graph_, see
+  // Graph::Visit.
+  template<class G>
+  bool Extend(const G &, int level, Weight gain, Kmove *);
+  // Checks whether the edges in t_ make up one of the reconnections and if so, sets the move.
+  bool Close(Weight gain, Kmove *);
+  void Enqueue(int v);
+
+  int k_;
+  std::shared_ptr<const NeighborLists> neighbors_;
+  std::vector<Reconnection> reconnections_;
+  // The graph with its nodes in the order of the original ids, for the distances between them.
+  Graph graph_;
+  Tour tour_{std::vector<int>()};
+  // The move being built: the removed edges are (t_[2i], t_[2i+1]) and edges_[i] is the node the edge leaves along
+  // the tour.
+  std::vector<int> t_, edges_;
+  std::deque<int> queue_;
+  std::vector<bool> queued_;
+};
+
+// A single improving move found by NeighborKopt, applied to the cycle.
+std::vector<CycleNode> LocalNeighbor(int k, const Graph &, std::shared_ptr<const NeighborLists>);
+
+}  // namespace kopt
+
+#endif  // KOPT_SRC_NEIGHBOR_KOPT_H_
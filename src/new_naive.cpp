@@ -3,28 +3,19 @@
 #include <algorithm>
 #include <array>
 #include <cassert>
-#include <cmath>
 #include <cstdlib>
-#include <cstring>
-#include <functional>
-#include <random>
+#include <vector>
 
 #include "common.h"
+#include "retrieve_solution.h"
 
 namespace kopt {
 namespace {
 
-std::vector<int> Sequence(int n) {
-  assert(n >= 0);
-  std::vector<int> seq(n);
-  for (int i = 0; i < n; ++i) seq[i] = i;
-  return seq;
-}
-
 constexpr int kMaxK = 7;
 
 struct Subset {
-  explicit Subset(int k = 0, int n = -1) : k(k) {
+  explicit Subset(int k = 0, int n = -1) : k(k), changed(k) {
     assert(k >= 0);
     assert(n == -1 || n >= k);
     for (int i = 0; i < k; ++i) v[i] = i;
@@ -40,8 +31,10 @@ struct Subset {
       v[i] = i;
     if (i < k) {
       ++v[i];
+      changed = i + 1;
       return true;
     } else {
+      changed = k;
       return false;
     }
   }
@@ -50,6 +43,8 @@ struct Subset {
   int MapNode(int x) const { return v[x / 2] + x % 2; }
 
   int k;
+  // The number of leading edges moved by the last call of Next; the nodes 2 * changed and above kept their places.
+  int changed;
   std::array<int, kMaxK + 1> v{};
 };
 
@@ -61,33 +56,11 @@ struct Frag {
   int Back() const { return 2 * idx + 2 - rev; }
 };
 
-struct SignatureId {
-  int K() const { return static_cast<int>(std::strlen(str.data()) + 1); }
-
-  Frag operator()(int i) const {
-    bool rev = str[i] >= 'a';
-    int idx = str[i] - (rev ? 'a' : 'A');
-    return Frag{idx, rev};
-  }
-
-  // A string of k-1 characters + terminating null.
-  std::array<char, kMaxK> str{};
-};
-
 struct Signature {
   struct Edge {
     int x, y;
   };
 
-  explicit Signature(SignatureId id) {
-    for (k = 0; id.str[k]; ++k) {
-      auto frag = id(k);
-      per[k] = frag.idx;
-      rev[k] = frag.rev;
-    }
-    UpdateEdges();
-  }
-
   explicit Signature(int k = 0) : k(k) {
     assert(k >= 0);
     if (k == 0)
@@ -101,11 +74,10 @@ struct Signature {
 
   int K() const { return k; }
 
-  SignatureId Id() const {
-    SignatureId id;
-    for (int i = 0; i < k; ++i)
-      id.str[i] = (rev[i] ? 'a' : 'A') + per[i];
-    id.str[k] = 0;
+  MatchingId Id() const {
+    MatchingId id{};
+    for (int i = 0; i < k - 1; ++i)
+      id[i] = static_cast<char>((rev[i] ? 'a' : 'A') + per[i]);
     return id;
   }
 
@@ -154,135 +126,118 @@ struct Signature {
   std::array<bool, kMaxK - 1> rev{};
 };
 
-using Weight = std::int64_t;
-
-struct Kmove {
-  Weight gain{};
-  SignatureId sig_id;
-  Subset subset;
-
-  std::vector<int> Cycle() const {
-    assert(sig_id.K() == subset.K() && subset.K() <= subset.N());
-    int k = subset.K(), n = subset.N();
-    if (k <= 1)
-      return Sequence(n);
-
-    std::vector<int> cycle;
-    cycle.reserve(subset.N());
-    auto AppendFragment = [&](int first, int last, int dir) {
-      for (int v = first; v != last + dir; v += dir)
-        cycle.emplace_back(v);
-    };
-
-    // The (implicit) last fragment crosses the n-1 / 0 boundary.
-    AppendFragment(0, subset.MapNode(0), 1);
-    for (int i = 0; i < k - 1; ++i) {
-      auto frag = sig_id(i);
-      int first = subset.MapNode(frag.Front());
-      int last = subset.MapNode(frag.Back());
-      int dir = frag.rev ? -1 : 1;
-      AppendFragment(first, last, dir);
+// The distances between the 2k endpoints of the removed edges of a subset: weight[Index(x, y)] for x < y is the
+// distance between its nodes x and y. At most 14 x 14 weights, so that it stays in L1.
+struct EndpointMatrix {
+  static constexpr int kSide = 2 * kMaxK;
+
+  static int Index(int x, int y) { return x * kSide + y; }
+
+  // Recomputes the rows of the nodes moved by the last Subset::Next, i.e. the pairs with a moved node.
+  template<class G>
+  void Update(const G &graph, const Subset &subset) {
+    int nodes = 2 * subset.K();
+    for (int x = 0; x < 2 * subset.changed; ++x) {
+      int u = subset.MapNode(x);
+      for (int y = x + 1; y < nodes; ++y)
+        weight[Index(x, y)] = graph(u, subset.MapNode(y));
     }
-    AppendFragment(subset.MapNode(2 * k - 1), n - 1, 1);
-    assert(Size(cycle) == n);
-
-    // Ensure the lexicographically smallest cycle is returned.
-    if (cycle[1] > cycle[n - 1])
-      std::reverse(cycle.begin() + 1, cycle.end());
-
-    return cycle;
   }
 
-  static bool GainCmp(const Kmove &l, const Kmove &r) { return l.gain > r.gain; }
+  std::array<Weight, kSide * kSide> weight{};
 };
 
-struct Graph {
-  struct Point {
-    double x, y;
-  };
-
-  static Graph Random(int n) {
-    Graph g(n);
-    std::uniform_int_distribution<> dist(1, 100 * n);
-    auto rand = std::bind(dist, Rng());
-    for (int i = 0; i < n; ++i) {
-      g.p[i].x = rand();
-      g.p[i].y = rand();
+// The added edges of all the irreducible signatures with k edges as indices into an EndpointMatrix, stored edge by
+// edge: index[e][s] is the e-th added edge of the s-th signature. The loops over the signatures then read consecutive
+// indices, which the compiler can vectorize.
+struct SignatureBank {
+  explicit SignatureBank(int k) : k(k) {
+    Signature signature(k);
+    while (signature.NextIrreducible()) {
+      ids.emplace_back(signature.Id());
+      for (int e = 0; e < k; ++e) {
+        auto [x, y] = std::minmax(signature.edge[e].x, signature.edge[e].y);
+        index[e].emplace_back(EndpointMatrix::Index(x, y));
+      }
     }
-    g.p[n] = g.p[0];
-    return g;
   }
 
-  explicit Graph(int n = 0) : n(n) {
-    assert(n >= 0);
-    p.resize(n + 1);
-  }
+  int Count() const { return Size(ids); }
 
-  Graph(const Graph &) = default;
-  Graph(Graph &&) = default;
-
-  Graph &operator=(const Graph &) = default;
-  Graph &operator=(Graph &&) = default;
-
-  int N() const { return n; }
-
-  Weight operator()(int x, int y) const {
-    assert(0 <= x && x <= n && 0 <= y && y <= n && x != y);
-    return Dist(p[x], p[y]);
-  }
-
-  int n;
-  std::vector<Point> p;  // Invariant: p.size() == n + 1 && p[0] == p[n].
-
- private:
-  static Weight Dist(Point a, Point b) {
-    // TSPLIB documentation dictates the use of cast instead of round().
-    // NOLINTNEXTLINE(bugprone-incorrect-roundings)
-    return Weight(std::sqrt((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y)) + 0.5);
-  }
+  int k;
+  std::vector<MatchingId> ids;
+  std::array<std::vector<int>, kMaxK> index;
 };
 
-Weight RemovedWeight(const Graph &graph, const Subset &subset) {
-  Weight weight = 0;
-  for (int i = 0; i < subset.K(); ++i) {
-    int edge = subset.MapEdge(i);
-    weight += graph(edge, edge + 1);
-  }
-  return weight;
+// The banks are built on first use and shared by all the calls.
+const SignatureBank &Bank(int k) {
+  static const std::array<SignatureBank, kMaxK + 1> banks = [] {
+    return std::array<SignatureBank, kMaxK + 1>{
+        SignatureBank(0), SignatureBank(1), SignatureBank(2), SignatureBank(3),
+        SignatureBank(4), SignatureBank(5), SignatureBank(6), SignatureBank(7)};
+  }();
+  return banks[k];
 }
 
-Weight AddedWeight(const Graph &graph, const Subset &subset, const Signature &sig) {
+template<class G>
+Weight RemovedWeight(const G &graph, const Subset &subset) {
   Weight weight = 0;
-  for (int i = 0; i < sig.K(); ++i) {
-    int x = subset.MapNode(sig.edge[i].x);
-    int y = subset.MapNode(sig.edge[i].y);
-    weight += graph(x, y);
-  }
+  for (int i = 0; i < subset.K(); ++i)
+    weight += graph.EdgeWeight(subset.MapEdge(i));
   return weight;
 }
 
-Kmove Kopt(int k, const Graph &graph) {
-  Kmove best;
-  Subset subset(k, graph.N());
-  Signature signature(k);
+template<class G>
+Kmove Kopt(int k, const G &graph, bool first_improvement) {
+  int n = graph.N();
+  if (n < k)
+    return Kmove{};
+  auto &bank = Bank(k);
+  int count = bank.Count();
+  EndpointMatrix matrix;
+  // added[s] is the weight of the edges added by the s-th signature.
+  std::vector<Weight> added(count);
+  Subset subset(k, n), best_subset;
+  Weight best_gain = 0;
+  int best_signature = -1;
   do {
-    auto removed_weight = RemovedWeight(graph, subset);
-    while (signature.NextIrreducible()) {
-      auto gain = removed_weight - AddedWeight(graph, subset, signature);
-      if (gain > best.gain)
-        best = Kmove{gain, signature.Id(), subset};
+    matrix.Update(graph, subset);
+    std::fill(added.begin(), added.end(), 0);
+    for (int e = 0; e < k; ++e) {
+      const int *index = bank.index[e].data();
+      for (int s = 0; s < count; ++s)
+        added[s] += matrix.weight[index[s]];
+    }
+    auto cheapest = std::min_element(added.begin(), added.end());
+    Weight gain = RemovedWeight(graph, subset) - *cheapest;
+    if (gain > best_gain) {
+      best_gain = gain;
+      best_subset = subset;
+      best_signature = static_cast<int>(cheapest - added.begin());
+      if (first_improvement) break;
     }
   } while (subset.Next());
-  return best;
-}
-
-void TestNewNaive_(int k, int n) {
-  auto g = Graph::Random(n);
-  Kopt(k, g);
+  if (best_signature < 0)
+    return Kmove{};
+  SlowEmbedding embedding(n);
+  for (int i = 0; i < k; ++i)
+    embedding.SetVal(SigEdge(i), CycleEdge(best_subset.MapEdge(i)));
+  return Kmove{best_gain, bank.ids[best_signature], embedding};
 }
 
 }  // namespace
 
-void TestNewNaive(int k, int n) { return TestNewNaive_(k, n); }
+Kmove SubsetKopt(int k, const Graph &graph, bool first_improvement) {
+  assert(2 <= k && k <= kMaxK);
+  return graph.Visit([&](const auto &view) { return Kopt(k, view, first_improvement); });
+}
+
+std::vector<CycleNode> LocalSubset(int k, const Graph &graph) {
+  auto move = SubsetKopt(k, graph, false);
+  if (move.gain > 0)
+    return RetrieveSolution(graph.N(), Matching(move.matching_id), move.embedding);
+  else
+    return IdentityCycle(graph.N());
+}
 
 }  // namespace kopt
@@ -1,9 +1,21 @@
 #ifndef KOPT_SRC_NEW_NAIVE_H__
 #define KOPT_SRC_NEW_NAIVE_H__
 
+#include <vector>
+
+#include "graph.h"
+#include "identifier.h"
+#include "slow_embedding.h"
+
 namespace kopt {
 
-void TestNewNaive(int k, int n);
+// Searches all the irreducible signatures with k edges at once: for every subset of k removed edges, the distances
+// between their 2k endpoints are computed once (only the rows of the moved edges are recomputed) and every signature
+// is then scored with k lookups. With first_improvement, returns the best move of the first subset with a positive
+// gain, otherwise the first move with the largest gain in the order of the subsets and signatures; a move with gain 0
+// if none improves.
+Kmove SubsetKopt(int k, const Graph &, bool first_improvement);
+std::vector<CycleNode> LocalSubset(int k, const Graph &);
 
 }  // namespace kopt
 
@@ -0,0 +1,151 @@
+#include "pruned_kopt.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <type_traits>
+
+#include "common.h"
+#include "retrieve_solution.h"
+
+namespace kopt {
+namespace {
+
+constexpr int kMaxK = 7;
+
+// The removed edges of a signature in the order of a sequential exchange. Step j removes the edge at position slot[j]
+// (of the sorted removed edges), entering it at its signature node in[j] and leaving it at in[j] ^ 1, which the next
+// added edge joins to in[j + 1]. The walk enters the removed edge start at its left node if side is 0 and at its right
+// node otherwise, which sets the direction of the first alternating cycle. When an added edge returns to the start of
+// the current cycle instead, closes[j] is set and step j + 1 starts a new cycle at the lowest removed edge left.
+struct Walk {
+  Walk(const Matching &matching, int k, int start, int side) : k(k) {
+    std::array<bool, kMaxK> used{};
+    int first = 2 * start + side;
+    int node = first;
+    for (int j = 0; j < k; ++j) {
+      slot[j] = node / 2;
+      in[j] = node;
+      used[node / 2] = true;
+      int next = matching(SigNode(node ^ 1)).id;
+      closes[j] = next == first;
+      if (closes[j] && j + 1 < k) {
+        int free = static_cast<int>(std::find(used.begin(), used.begin() + k, false) - used.begin());
+        first = next = 2 * free;
+      }
+      node = next;
+    }
+    assert(closes[k - 1]);
+  }
+
+  int k;
+  std::array<int, kMaxK> slot{}, in{};
+  std::array<bool, kMaxK> closes{};
+};
+
+template<class G>
+class Search {
+ public:
+  Search(const G &graph, const Matching &matching, int k, bool first_improvement)
+      : graph_(graph), matching_(matching), k_(k), n_(graph.N()), first_improvement_(first_improvement) {}
+
+  Kmove Run() {
+    if (n_ < k_)
+      return Kmove{};
+    for (int start = 0; start < 2 * k_ && !(first_improvement_ && best_gain_ > 0); ++start) {
+      Walk walk(matching_, k_, start / 2, start % 2);
+      walk_ = &walk;
+      assigned_.fill(false);
+      Step(0, 0, 0);
+    }
+    if (best_gain_ <= 0)
+      return Kmove{};
+    SlowEmbedding embedding(n_);
+    for (int i = 0; i < k_; ++i)
+      embedding.SetVal(SigEdge(i), CycleEdge(best_[i]));
+    return Kmove{best_gain_, matching_.Id(), embedding};
+  }
+
+ private:
+  int MapNode(int x) const { return v_[x / 2] + x % 2; }
+
+  // Removes the edge of step j, for every position left to it by the edges removed so far. gain is the partial gain
+  // of the steps before, and from the node the pending added edge leaves from (unused at the start of a cycle).
+  // Returns true once the search is done.
+  bool Step(int j, int64_t gain, int from) {
+    int slot = walk_->slot[j];
+    // The positions are increasing with the slots, so every edge in between needs one.
+    int lo = slot, hi = n_ - k_ + slot;
+    for (int s = 0; s < k_; ++s) {
+      if (!assigned_[s]) continue;
+      if (s < slot) lo = std::max(lo, v_[s] + slot - s);
+      else hi = std::min(hi, v_[s] - (s - slot));
+    }
+    bool starts_cycle = j == 0 || walk_->closes[j - 1];
+    assigned_[slot] = true;
+    for (v_[slot] = lo; v_[slot] <= hi; ++v_[slot]) {
+      int64_t partial = gain;
+      if (!starts_cycle) {
+        partial -= graph_(from, MapNode(walk_->in[j]));
+        // The positive gain criterion, checked after every added edge.
+        if (partial <= 0) continue;
+      }
+      partial += graph_.EdgeWeight(v_[slot]);
+      int out = MapNode(walk_->in[j] ^ 1);
+      if (walk_->closes[j]) {
+        partial -= graph_(out, MapNode(matching_(SigNode(walk_->in[j] ^ 1)).id));
+        if (j + 1 == k_) {
+          if (partial > best_gain_) {
+            best_gain_ = partial;
+            for (int s = 0; s < k_; ++s)
+              best_[s] = v_[s];
+            if (first_improvement_) return true;
+          }
+          continue;
+        }
+        if (partial <= 0) continue;
+      }
+      if (Step(j + 1, partial, out))
+        return true;
+    }
+    assigned_[slot] = false;
+    return false;
+  }
+
+  const G &graph_;
+  const Matching &matching_;
+  int k_, n_;
+  bool first_improvement_;
+  const Walk *walk_ = nullptr;
+  // The positions of the removed edges, valid where assigned.
+  std::array<int, kMaxK> v_{}, best_{};
+  std::array<bool, kMaxK> assigned_{};
+  int64_t best_gain_ = 0;
+};
+
+}  // namespace
+
+Kmove PrunedKopt(MatchingId id, const Graph &graph, bool first_improvement) {
+  Matching matching(id);
+  int k = Len(id) + 1;
+  assert(2 <= k && k <= kMaxK);
+  return graph.Visit([&](const auto &view) {
+    return Search<std::decay_t<decltype(view)>>(view, matching, k, first_improvement).Run();
+  });
+}
+
+std::vector<CycleNode> LocalPruned(int k, const Graph &graph) {
+  Kmove best;
+  Matching matching(k);
+  while (matching.NextIrreducible()) {
+    auto move = PrunedKopt(matching.Id(), graph, false);
+    if (move.gain > best.gain)
+      best = move;
+  }
+  if (best.gain > 0)
+    return RetrieveSolution(graph.N(), Matching(best.matching_id), best.embedding);
+  else
+    return IdentityCycle(graph.N());
+}
+
+}  // namespace kopt
@@ -0,0 +1,28 @@
+#ifndef KOPT_SRC_PRUNED_KOPT_H_
+#define KOPT_SRC_PRUNED_KOPT_H_
+
+#include <vector>
+
+#include "graph.h"
+#include "identifier.h"
+#include "matching.h"
+#include "slow_embedding.h"
+
+namespace kopt {
+
+// Searches the embeddings of a signature as Lin-Kernighan builds a sequential exchange: edge by edge along the
+// alternating cycles of the signature, the removed edges alternating with the added ones, and only as long as the
+// removed edges outweigh the added ones so far (the positive gain criterion). Every removed edge of the signature is
+// tried as the first one, entered from either end, so that a single alternating cycle is walked from each of its
+// edges in both directions. One of these walks sees only positive partial gains on the way to the best move, so the
+// pruning never loses it. Signatures with several cycles join them one after the other, and may miss moves whose
+// first cycles do not gain enough on their own. Returns the first improving move found with first_improvement,
+// otherwise the best one; a move with gain 0 if none is found.
+Kmove PrunedKopt(MatchingId, const Graph &, bool first_improvement);
+
+// The best move over all the irreducible signatures with k edges.
+std::vector<CycleNode> LocalPruned(int k, const Graph &);
+
+}  // namespace kopt
+
+#endif  // KOPT_SRC_PRUNED_KOPT_H_
@@ -0,0 +1,239 @@
+#include "spatial_index.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <utility>
+
+namespace kopt {
+namespace {
+
+// Subtrees with at most this many points are leaves.
+constexpr int kLeafSize = 8;
+
+double Distance2(Point p, double x, double y) {
+  return (p.x - x) * (p.x - x) + (p.y - y) * (p.y - y);
+}
+
+bool InQuadrant(Point p, int quadrant, double x, double y) {
+  switch (quadrant) {
+    case 0: return x >= p.x && y >= p.y;
+    case 1: return x < p.x && y >= p.y;
+    case 2: return x < p.x && y < p.y;
+    case 3: return x >= p.x && y < p.y;
+    default: return true;
+  }
+}
+
+}  // namespace
+
+KdTree::KdTree(const Graph &graph)
+    : x_(graph.N()), y_(graph.N()), points_(Sequence(graph.N())), leaf_of_(graph.N()), removed_(graph.N()) {
+  for (int v = 0; v < graph.N(); ++v) {
+    x_[v] = graph[v].x;
+    y_[v] = graph[v].y;
+  }
+  if (graph.N())
+    Build(0, graph.N(), -1);
+  // Queries read the coordinates of whole leaves, so they are stored in the order of points_.
+  std::vector<double> x(graph.N()), y(graph.N());
+  for (int i = 0; i < graph.N(); ++i) {
+    x[i] = x_[points_[i]];
+    y[i] = y_[points_[i]];
+  }
+  x_ = std::move(x);
+  y_ = std::move(y);
+}
+
+int KdTree::Build(int begin, int end, int parent) {
+  int id = Size(nodes_);
+  nodes_.emplace_back();
+  {
+    auto &node = nodes_[id];
+    node.begin = begin;
+    node.end = end;
+    node.parent = parent;
+    node.alive = end - begin;
+    node.min_x = node.min_y = std::numeric_limits<double>::infinity();
+    node.max_x = node.max_y = -std::numeric_limits<double>::infinity();
+    for (int i = begin; i < end; ++i) {
+      int v = points_[i];
+      node.min_x = std::min(node.min_x, x_[v]);
+      node.max_x = std::max(node.max_x, x_[v]);
+      node.min_y = std::min(node.min_y, y_[v]);
+      node.max_y = std::max(node.max_y, y_[v]);
+    }
+  }
+  if (end - begin <= kLeafSize) {
+    for (int i = begin; i < end; ++i)
+      leaf_of_[points_[i]] = id;
+    return id;
+  }
+  // Splits the longer side of the bounding box at the median.
+  bool split_x = nodes_[id].max_x - nodes_[id].min_x >= nodes_[id].max_y - nodes_[id].min_y;
+  const auto &coordinate = split_x ? x_ : y_;
+  int middle = begin + (end - begin) / 2;
+  std::nth_element(points_.begin() + begin, points_.begin() + middle, points_.begin() + end,
+                   [&coordinate](int u, int v) { return coordinate[u] < coordinate[v]; });
+  int left = Build(begin, middle, id);
+  int right = Build(middle, end, id);
+  nodes_[id].left = left;
+  nodes_[id].right = right;
+  return id;
+}
+
+double KdTree::BoxDistance2(const Node &node, Point p) {
+  double dx = std::max({node.min_x - p.x, 0.0, p.x - node.max_x});
+  double dy = std::max({node.min_y - p.y, 0.0, p.y - node.max_y});
+  return dx * dx + dy * dy;
+}
+
+bool KdTree::BoxInQuadrant(const Node &node, Point p, int quadrant) {
+  switch (quadrant) {
+    case 0: return node.max_x >= p.x && node.max_y >= p.y;
+    case 1: return node.min_x < p.x && node.max_y >= p.y;
+    case 2: return node.min_x < p.x && node.min_y < p.y;
+    case 3: return node.max_x >= p.x && node.min_y < p.y;
+    default: return true;
+  }
+}
+
+void KdTree::Search(Point p, int quadrant, int k, std::vector<int> *result) const {
+  result->clear();
+  if (k <= 0 || nodes_.empty())
+    return;
+  // A max-heap of the k nearest nodes found so far, as (squared distance, position).
+  std::vector<std::pair<double, int>> heap;
+  auto visit = [&](auto &self, int id) -> void {
+    auto &node = nodes_[id];
+    if (node.alive == 0 || !BoxInQuadrant(node, p, quadrant))
+      return;
+    if (Size(heap) == k && BoxDistance2(node, p) > heap.front().first)
+      return;
+    if (node.left < 0) {
+      for (int i = node.begin; i < node.end; ++i) {
+        int v = points_[i];
+        if (removed_[v] || !InQuadrant(p, quadrant, x_[i], y_[i]))
+          continue;
+        std::pair<double, int> candidate(Distance2(p, x_[i], y_[i]), v);
+        if (Size(heap) < k) {
+          heap.emplace_back(candidate);
+          std::push_heap(heap.begin(), heap.end());
+        } else if (candidate < heap.front()) {
+          std::pop_heap(heap.begin(), heap.end());
+          heap.back() = candidate;
+          std::push_heap(heap.begin(), heap.end());
+        }
+      }
+      return;
+    }
+    int near = node.left, far = node.right;
+    if (BoxDistance2(nodes_[far], p) < BoxDistance2(nodes_[near], p))
+      std::swap(near, far);
+    self(self, near);
+    self(self, far);
+  };
+  visit(visit, 0);
+  std::sort_heap(heap.begin(), heap.end());
+  for (auto &entry : heap)
+    result->emplace_back(entry.second);
+}
+
+void KdTree::Nearest(Point p, int k, std::vector<int> *result) const {
+  Search(p, -1, k, result);
+}
+
+void KdTree::NearestInQuadrant(Point p, int quadrant, int k, std::vector<int> *result) const {
+  assert(0 <= quadrant && quadrant < 4);
+  Search(p, quadrant, k, result);
+}
+
+void KdTree::Within(Point p, double radius, std::vector<int> *result) const {
+  result->clear();
+  if (nodes_.empty())
+    return;
+  double radius2 = radius * radius;
+  auto visit = [&](auto &self, int id) -> void {
+    auto &node = nodes_[id];
+    if (node.alive == 0 || BoxDistance2(node, p) > radius2)
+      return;
+    if (node.left < 0) {
+      for (int i = node.begin; i < node.end; ++i) {
+        int v = points_[i];
+        if (!removed_[v] && Distance2(p, x_[i], y_[i]) <= radius2)
+          result->emplace_back(v);
+      }
+      return;
+    }
+    self(self, node.left);
+    self(self, node.right);
+  };
+  visit(visit, 0);
+}
+
+void KdTree::Remove(int v) {
+  if (removed_[v])
+    return;
+  removed_[v] = true;
+  for (int id = leaf_of_[v]; id >= 0; id = nodes_[id].parent)
+    --nodes_[id].alive;
+}
+
+NeighborLists::NeighborLists(int n, int k, std::vector<std::int32_t> candidates)
+    : n_(n), k_(k), candidates_(std::move(candidates)) {
+  assert(std::size_t(n) * k == candidates_.size());
+}
+
+std::shared_ptr<const NeighborLists> NeighborLists::Build(const Graph &graph, int k, bool quadrant) {
+  int n = graph.N();
+  k = std::max(0, std::min(k, n - 1));
+  const auto &perm = graph.GetPermutation();
+  std::vector<std::int32_t> candidates(std::size_t(n) * k);
+  // The candidates of position u, by positions.
+  std::vector<int> list, found;
+  std::vector<std::pair<Weight, int>> sorted;
+  auto store = [&](int u) {
+    sorted.clear();
+    for (int v : list)
+      sorted.emplace_back(graph(u, v), perm[v]);
+    std::sort(sorted.begin(), sorted.end());
+    for (int i = 0; i < k; ++i)
+      candidates[std::size_t(perm[u]) * k + i] = sorted[i].second;
+  };
+
+  if (!graph.HasCoordinates()) {
+    for (int u = 0; u < n; ++u) {
+      sorted.clear();
+      for (int v = 0; v < n; ++v)
+        if (v != u) sorted.emplace_back(graph(u, v), perm[v]);
+      std::partial_sort(sorted.begin(), sorted.begin() + k, sorted.end());
+      for (int i = 0; i < k; ++i)
+        candidates[std::size_t(perm[u]) * k + i] = sorted[i].second;
+    }
+    return std::make_shared<const NeighborLists>(n, k, std::move(candidates));
+  }
+
+  KdTree tree(graph);
+  auto add = [&](int u, int limit) {
+    for (int v : found)
+      if (v != u && Size(list) < limit && std::find(list.begin(), list.end(), v) == list.end())
+        list.emplace_back(v);
+  };
+  for (int u = 0; u < n; ++u) {
+    list.clear();
+    Point p = graph[u];
+    if (quadrant) {
+      for (int q = 0; q < 4; ++q) {
+        // The node itself and its duplicates lie in quadrant 0.
+        tree.NearestInQuadrant(p, q, k / 4 + (q == 0), &found);
+        add(u, Size(list) + k / 4);
+      }
+    }
+    tree.Nearest(p, k + 1, &found);
+    add(u, k);
+    store(u);
+  }
+  return std::make_shared<const NeighborLists>(n, k, std::move(candidates));
+}
+
+}  // namespace kopt
@@ -0,0 +1,79 @@
+#ifndef KOPT_SRC_SPATIAL_INDEX_H_
+#define KOPT_SRC_SPATIAL_INDEX_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "graph.h"
+
+namespace kopt {
+
+// A k-d tree over the nodes of a graph with coordinates, by their current positions. Distances are Euclidean in the
+// plane of the coordinates, which orders the nodes as the weights do for EUC_2D, CEIL_2D and ATT and approximately for
+// the other metrics. Nodes can be removed, e.g. once they are visited, and are skipped by later queries.
+class KdTree {
+ public:
+  explicit KdTree(const Graph &graph);
+
+  // Sets *result to the k nearest nodes to p that have not been removed (fewer if there are not enough of them),
+  // nearest first. Ties are broken by position.
+  void Nearest(Point p, int k, std::vector<int> *result) const;
+  // The same, restricted to the nodes in one of the four quadrants around p: 0 for x >= p.x and y >= p.y, 1 for
+  // x < p.x and y >= p.y, 2 for x < p.x and y < p.y, and 3 for x >= p.x and y < p.y.
+  void NearestInQuadrant(Point p, int quadrant, int k, std::vector<int> *result) const;
+  // Sets *result to the nodes within the given distance of p that have not been removed, in no particular order.
+  void Within(Point p, double radius, std::vector<int> *result) const;
+
+  void Remove(int v);
+
+ private:
+  struct Node {
+    int begin, end;  // The range of points_ in the subtree.
+    int left = -1, right = -1;  // Children, -1 in leaves.
+    int parent = -1;
+    int alive = 0;  // The number of nodes of the subtree that have not been removed.
+    double min_x, max_x, min_y, max_y;  // The bounding box of the subtree.
+  };
+
+  int Build(int begin, int end, int parent);
+  static double BoxDistance2(const Node &, Point p);
+  static bool BoxInQuadrant(const Node &, Point p, int quadrant);
+  // Nearest and NearestInQuadrant, with quadrant -1 for all nodes.
+  void Search(Point p, int quadrant, int k, std::vector<int> *result) const;
+
+  std::vector<double> x_, y_;  // By position while building, then in the order of points_.
+  std::vector<int> points_;  // The positions, ordered so that every subtree is a range.
+  std::vector<Node> nodes_;
+  std::vector<int> leaf_of_;
+  std::vector<bool> removed_;
+};
+
+// Candidate neighbors of every node, by original ids, for engines that only try adding edges to near nodes. The
+// candidates of a node are sorted by weight, then by id.
+class NeighborLists {
+ public:
+  // The k nearest nodes of every node (all the other nodes if n <= k). Graphs with coordinates use a KdTree; if
+  // quadrant is set, up to k/4 candidates come from each quadrant around the node before the nearest remaining nodes
+  // fill the list, which helps on clustered instances. EXPLICIT graphs scan the whole matrix and ignore quadrant.
+  static std::shared_ptr<const NeighborLists> Build(const Graph &graph, int k, bool quadrant = false);
+  // Lists of k candidates stored consecutively, e.g. loaded from an instance cache.
+  NeighborLists(int n, int k, std::vector<std::int32_t> candidates);
+
+  int N() const { return n_; }
+  int K() const { return k_; }
+  // The candidates of the node with the given original id.
+  const std::int32_t *operator[](int id) const {
+    assert(0 <= id && id < n_);
+    return candidates_.data() + std::size_t(id) * k_;
+  }
+  const std::vector<std::int32_t> &Data() const { return candidates_; }
+
+ private:
+  int n_, k_;
+  std::vector<std::int32_t> candidates_;
+};
+
+}  // namespace kopt
+
+#endif  // KOPT_SRC_SPATIAL_INDEX_H_
@@ -0,0 +1,107 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+
+#include "common.h"
+
+namespace kopt {
+
+ThreadPool::ThreadPool(int threads) {
+  for (int i = 1; i < threads; ++i)
+    workers_.emplace_back(&ThreadPool::Work, this);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (auto &worker : workers_)
+    worker.join();
+}
+
+void ThreadPool::Run(int count, const std::function<void(int)> &task) {
+  if (workers_.empty() || count <= 1) {
+    for (int i = 0; i < count; ++i)
+      task(i);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(busy_ == 0);
+    task_ = &task;
+    count_ = count;
+    next_ = 0;
+    busy_ = static_cast<int>(workers_.size());
+    ++generation_;
+  }
+  wake_.notify_all();
+  Drain();
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this] { return busy_ == 0; });
+  task_ = nullptr;
+}
+
+void ThreadPool::Work() {
+  std::uint64_t seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+      if (stop_)
+        return;
+      seen = generation_;
+    }
+    Drain();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--busy_ == 0)
+      done_.notify_one();
+  }
+}
+
+void ThreadPool::Drain() {
+  for (int i = next_++; i < count_; i = next_++)
+    (*task_)(i);
+}
+
+namespace {
+
+std::unique_ptr<ThreadPool> &SharedPool() {
+  static std::unique_ptr<ThreadPool> pool;
+  return pool;
+}
+
+}  // namespace
+
+void SetWorkers(int threads) {
+  SharedPool() = std::make_unique<ThreadPool>(std::max(threads, 1));
+}
+
+ThreadPool &Workers() {
+  auto &pool = SharedPool();
+  if (!pool)
+    SetWorkers(1);
+  return *pool;
+}
+
+std::vector<int> BalancedChunks(int rows, int chunks, const std::function<double(int)> &work) {
+  assert(rows >= 0 && chunks >= 1);
+  double total = 0;
+  for (int i = 0; i < rows; ++i)
+    total += work(i);
+  std::vector<int> bounds{0};
+  double done = 0;
+  for (int i = 0; i < rows; ++i) {
+    done += work(i);
+    // Closes the current range once it reaches its share of the work.
+    if (done * chunks >= total * Size(bounds) && i + 1 < rows)
+      bounds.emplace_back(i + 1);
+  }
+  bounds.emplace_back(rows);
+  return bounds;
+}
+
+}  // namespace kopt
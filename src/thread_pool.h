@@ -0,0 +1,57 @@
+#ifndef KOPT_SRC_THREAD_POOL_H_
+#define KOPT_SRC_THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kopt {
+
+// A fixed set of threads running the tasks of one Run call at a time. The calling thread takes part in the work, so a
+// pool of one thread has no workers and runs everything on the caller.
+class ThreadPool {
+ public:
+  explicit ThreadPool(int threads);
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ~ThreadPool();
+
+  int Threads() const { return static_cast<int>(workers_.size()) + 1; }
+  // Calls task(i) for every i in [0, count), each exactly once and in no particular order or thread, and returns once
+  // all the calls have finished. Must not be called from a task.
+  void Run(int count, const std::function<void(int)> &task);
+
+ private:
+  void Work();
+  // Runs the tasks of the current Run call until none are left.
+  void Drain();
+
+  std::mutex mutex_;
+  std::condition_variable wake_, done_;
+  const std::function<void(int)> *task_ = nullptr;
+  int count_ = 0;
+  std::atomic<int> next_{0};
+  int busy_ = 0;  // The number of workers still running tasks of the current call.
+  std::uint64_t generation_ = 0;  // The number of Run calls, for the workers to notice a new one.
+  bool stop_ = false;
+  std::vector<std::thread> workers_;
+};
+
+// Replaces the pool shared by the parallel engines with one of the given number of threads. Must not be called while
+// the pool runs tasks.
+void SetWorkers(int threads);
+// The pool shared by the parallel engines, of a single thread until SetWorkers is called.
+ThreadPool &Workers();
+
+// Splits the rows [0, rows) into at most `chunks` consecutive ranges of about equal total work, where work(i) is the
+// cost of row i, e.g. n - i for the rows of a triangular loop. Returns the boundaries: range c is [bounds[c],
+// bounds[c + 1]).
+std::vector<int> BalancedChunks(int rows, int chunks, const std::function<double(int)> &work);
+
+}  // namespace kopt
+
+#endif  // KOPT_SRC_THREAD_POOL_H_
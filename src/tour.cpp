@@ -0,0 +1,206 @@
+#include "tour.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <utility>
+
+namespace kopt {
+
+Tour::Tour(const std::vector<int> &order) : segment_of_(order.size()), index_of_(order.size()) {
+  Build(order);
+}
+
+void Tour::Build(const std::vector<int> &order) {
+  int n = static_cast<int>(order.size());
+  int length = std::max(1, static_cast<int>(std::sqrt(n)));
+  int count = (n + length - 1) / length;
+  segments_.assign(count, Segment());
+  order_.resize(count);
+  for (int s = 0; s < count; ++s) {
+    auto &segment = segments_[s];
+    segment.rank = s;
+    segment.nodes.assign(order.begin() + s * length, order.begin() + std::min(n, (s + 1) * length));
+    for (int i = 0; i < static_cast<int>(segment.nodes.size()); ++i) {
+      segment_of_[segment.nodes[i]] = s;
+      index_of_[segment.nodes[i]] = i;
+    }
+    order_[s] = s;
+  }
+  max_segments_ = 2 * count + 4;
+}
+
+void Tour::Rebuild() {
+  Build(BaseOrder());
+}
+
+std::vector<int> Tour::BaseOrder() const {
+  std::vector<int> order;
+  order.reserve(N());
+  for (int s : order_) {
+    auto &nodes = segments_[s].nodes;
+    if (segments_[s].reversed)
+      order.insert(order.end(), nodes.rbegin(), nodes.rend());
+    else
+      order.insert(order.end(), nodes.begin(), nodes.end());
+  }
+  return order;
+}
+
+int Tour::BaseNext(int v) const {
+  auto &segment = segments_[segment_of_[v]];
+  int i = index_of_[v] + (segment.reversed ? -1 : 1);
+  if (0 <= i && i < static_cast<int>(segment.nodes.size()))
+    return segment.nodes[i];
+  auto &next = segments_[order_[segment.rank + 1 < static_cast<int>(order_.size()) ? segment.rank + 1 : 0]];
+  return next.reversed ? next.nodes.back() : next.nodes.front();
+}
+
+int Tour::BasePrev(int v) const {
+  auto &segment = segments_[segment_of_[v]];
+  int i = index_of_[v] + (segment.reversed ? 1 : -1);
+  if (0 <= i && i < static_cast<int>(segment.nodes.size()))
+    return segment.nodes[i];
+  auto &prev = segments_[order_[segment.rank > 0 ? segment.rank - 1 : order_.size() - 1]];
+  return prev.reversed ? prev.nodes.front() : prev.nodes.back();
+}
+
+std::pair<int, int> Tour::BasePosition(int v) const {
+  auto &segment = segments_[segment_of_[v]];
+  int index = segment.reversed ? static_cast<int>(segment.nodes.size()) - 1 - index_of_[v] : index_of_[v];
+  return {segment.rank, index};
+}
+
+bool Tour::BaseBetween(int a, int b, int c) const {
+  auto pa = BasePosition(a), pb = BasePosition(b), pc = BasePosition(c);
+  if (pa <= pc)
+    return pa <= pb && pb <= pc;
+  return pa <= pb || pb <= pc;
+}
+
+void Tour::Split(int s, int index) {
+  auto &segment = segments_[s];
+  // Makes the direction of the list the physical order of the nodes.
+  if (segment.reversed) {
+    std::reverse(segment.nodes.begin(), segment.nodes.end());
+    for (int i = 0; i < static_cast<int>(segment.nodes.size()); ++i)
+      index_of_[segment.nodes[i]] = i;
+    segment.reversed = false;
+  }
+  Segment tail;
+  tail.nodes.assign(segment.nodes.begin() + index, segment.nodes.end());
+  segment.nodes.resize(index);
+  int t = static_cast<int>(segments_.size());
+  for (int i = 0; i < static_cast<int>(tail.nodes.size()); ++i) {
+    segment_of_[tail.nodes[i]] = t;
+    index_of_[tail.nodes[i]] = i;
+  }
+  order_.insert(order_.begin() + segments_[s].rank + 1, t);
+  segments_.emplace_back(std::move(tail));
+  for (int r = segments_[s].rank + 1; r < static_cast<int>(order_.size()); ++r)
+    segments_[order_[r]].rank = r;
+}
+
+void Tour::SplitBefore(int v) {
+  int index = BasePosition(v).second;
+  if (index > 0)
+    Split(segment_of_[v], index);
+}
+
+void Tour::SplitAfter(int v) {
+  int index = BasePosition(v).second;
+  if (index + 1 < static_cast<int>(segments_[segment_of_[v]].nodes.size()))
+    Split(segment_of_[v], index + 1);
+}
+
+void Tour::BaseReverse(int a, int b) {
+  if (static_cast<int>(order_.size()) + 2 > max_segments_)
+    Rebuild();
+  if (BasePosition(a) > BasePosition(b)) {
+    // The path wraps around the end of the list. Reversing the rest of the cycle instead and then the direction of the
+    // whole cycle gives the same result.
+    int rest_a = BaseNext(b), rest_b = BasePrev(a);
+    reversed_ = !reversed_;
+    if (rest_a == a)
+      return;
+    a = rest_a;
+    b = rest_b;
+  }
+  SplitBefore(a);
+  SplitAfter(b);
+  int begin = segments_[segment_of_[a]].rank, end = segments_[segment_of_[b]].rank + 1;
+  std::reverse(order_.begin() + begin, order_.begin() + end);
+  for (int r = begin; r < end; ++r) {
+    auto &segment = segments_[order_[r]];
+    segment.reversed = !segment.reversed;
+    segment.rank = r;
+  }
+}
+
+void Tour::Reverse(int a, int b) {
+  if (reversed_)
+    BaseReverse(b, a);
+  else
+    BaseReverse(a, b);
+}
+
+void Tour::Apply(const Matching &matching, const EmbeddingInterface &embedding) {
+  int k = matching.Domain().Size() / 2;
+  // Path i leads from the head of removed edge i to the tail of removed edge i + 1.
+  std::vector<int> first(k), last(k);
+  for (int i = 0; i < k; ++i) {
+    first[i] = Next(embedding(SigEdge(i)).id);
+    last[(i + k - 1) % k] = embedding(SigEdge(i)).id;
+  }
+
+  // The new cycle, as a sequence of (path, reversed). It starts after path k-1, which is kept in place.
+  std::vector<std::pair<int, bool>> target;
+  SigNode at(0);
+  for (int i = 0; i < k; ++i) {
+    SigNode node = matching(at);
+    int edge = node.Edge().id;
+    if (node.IsLeft()) {
+      int path = (edge + k - 1) % k;
+      target.emplace_back(path, true);
+      at = SigEdge(path).Right();
+    } else {
+      target.emplace_back(edge, false);
+      at = SigEdge((edge + 1) % k).Left();
+    }
+  }
+  assert(at == SigNode(0) && target.back() == std::make_pair(k - 1, false));
+
+  // Sorts the paths 0, ..., k-2 into the target order by reversals of consecutive paths.
+  std::vector<std::pair<int, bool>> current;
+  for (int i = 0; i + 1 < k; ++i)
+    current.emplace_back(i, false);
+  auto reverse = [&](int begin, int end) {
+    auto [from, from_reversed] = current[begin];
+    auto [to, to_reversed] = current[end];
+    Reverse(from_reversed ? last[from] : first[from], to_reversed ? first[to] : last[to]);
+    std::reverse(current.begin() + begin, current.begin() + end + 1);
+    for (int i = begin; i <= end; ++i)
+      current[i].second = !current[i].second;
+  };
+  for (int i = 0; i + 1 < k; ++i) {
+    int j = i;
+    while (current[j].first != target[i].first) ++j;
+    if (j != i)
+      reverse(i, j);
+    if (current[i].second != target[i].second)
+      reverse(i, i);
+  }
+}
+
+std::vector<int> Tour::Order(int first) const {
+  if (N() == 0)
+    return {};
+  // Copies the segments in the direction of the list, then turns the result to start at first along Next.
+  std::vector<int> order = BaseOrder();
+  if (reversed_)
+    std::reverse(order.begin(), order.end());
+  std::rotate(order.begin(), std::find(order.begin(), order.end(), first), order.end());
+  return order;
+}
+
+}  // namespace kopt
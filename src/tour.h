@@ -0,0 +1,75 @@
+#ifndef KOPT_SRC_TOUR_H_
+#define KOPT_SRC_TOUR_H_
+
+#include <utility>
+#include <vector>
+
+#include "embedding.h"
+#include "matching.h"
+
+namespace kopt {
+
+// A Hamiltonian cycle on nodes 0, ..., n-1 stored as a two-level list: the cycle is cut into O(sqrt n) segments, which
+// are kept in cycle order and have reversal bits. Next, Prev and Between take O(1) time, reversing a path takes
+// O(sqrt n) amortized time, and so applying a k-opt move takes O(k sqrt n) amortized time instead of rebuilding the
+// whole cycle.
+class Tour {
+ public:
+  // Creates the cycle visiting the nodes in the given order, a permutation of 0, ..., n-1.
+  explicit Tour(const std::vector<int> &order);
+
+  int N() const { return static_cast<int>(segment_of_.size()); }
+  int Next(int v) const { return reversed_ ? BasePrev(v) : BaseNext(v); }
+  int Prev(int v) const { return reversed_ ? BaseNext(v) : BasePrev(v); }
+  // True if b lies on the path from a to c following Next, including the ends.
+  bool Between(int a, int b, int c) const { return reversed_ ? BaseBetween(c, b, a) : BaseBetween(a, b, c); }
+
+  // Reverses the path from a to b following Next.
+  void Reverse(int a, int b);
+  // Applies the k-opt move which removes the edges (v, Next(v)) for the nodes v given by the embedding, in cycle order
+  // starting from the first one, and reconnects the paths between them according to the matching, as RetrieveSolution
+  // does for a cycle of positions. The embedding maps each removed edge to the node it leaves.
+  void Apply(const Matching &, const EmbeddingInterface &);
+
+  // The nodes in cycle order, starting from first.
+  std::vector<int> Order(int first = 0) const;
+
+ private:
+  struct Segment {
+    std::vector<int> nodes;
+    bool reversed = false;
+    int rank = 0;  // The position in order_.
+  };
+
+  // Next, Prev and Between in the direction of the segment list, ignoring reversed_.
+  int BaseNext(int v) const;
+  int BasePrev(int v) const;
+  bool BaseBetween(int a, int b, int c) const;
+  // The position of v in the direction of the segment list, as (rank of the segment, index in the segment).
+  std::pair<int, int> BasePosition(int v) const;
+  // Reverses the path from a to b following BaseNext.
+  void BaseReverse(int a, int b);
+  // Splits the segment of v so that v becomes the first (or last) node of its segment in the direction of the list.
+  void SplitBefore(int v);
+  void SplitAfter(int v);
+  // Moves the nodes from the given index on (in the direction of the list) to a new segment following it.
+  void Split(int segment, int index);
+  // Cuts the cycle into segments of equal length.
+  void Build(const std::vector<int> &order);
+  // Builds the list again in its current direction.
+  void Rebuild();
+  // The nodes in the direction of the list, starting from its first segment.
+  std::vector<int> BaseOrder() const;
+
+  std::vector<Segment> segments_;
+  std::vector<int> order_;  // The segments in cycle order.
+  std::vector<int> segment_of_;
+  std::vector<int> index_of_;  // The index of the node in segments_[segment_of_[v]].nodes.
+  bool reversed_ = false;
+  // Splits make the segments shorter and more numerous; the list is rebuilt once there are too many of them.
+  int max_segments_ = 0;
+};
+
+}  // namespace kopt
+
+#endif  // KOPT_SRC_TOUR_H_
@@ -0,0 +1,86 @@
+#include "tour.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "matching.h"
+#include "retrieve_solution.h"
+#include "slow_embedding.h"
+
+namespace kopt {
+namespace {
+
+// Whether the tour visits the nodes of the reference cycle in its order, starting from its first node.
+bool Follows(const Tour &tour, const std::vector<int> &cycle) {
+  return tour.Order(cycle[0]) == cycle;
+}
+
+TEST(TourTest, NextPrevAndBetween) {
+  std::vector<int> order{3, 0, 4, 1, 5, 2, 6};
+  Tour tour(order);
+  int n = static_cast<int>(order.size());
+  for (int i = 0; i < n; ++i) {
+    EXPECT_EQ(tour.Next(order[i]), order[(i + 1) % n]);
+    EXPECT_EQ(tour.Prev(order[i]), order[(i + n - 1) % n]);
+  }
+  EXPECT_TRUE(tour.Between(0, 1, 2));
+  EXPECT_TRUE(tour.Between(2, 3, 4));
+  EXPECT_FALSE(tour.Between(4, 0, 2));
+}
+
+TEST(TourTest, ReverseWrapsAround) {
+  Tour tour({0, 1, 2, 3, 4, 5});
+  tour.Reverse(4, 1);
+  std::vector<int> expected{2, 3, 1, 0, 5, 4};
+  EXPECT_EQ(tour.Order(2), expected);
+}
+
+// Applies random moves of every irreducible signature with k = 2, ..., 6 to a tour and to a cycle stored as a vector,
+// which takes the new cycle from RetrieveSolution, and compares them after every move.
+TEST(TourTest, ApplyMatchesRetrieveSolution) {
+  std::mt19937 engine(1);
+  for (int k = 2; k <= 6; ++k) {
+    std::vector<MatchingId> signatures;
+    Matching matching(k);
+    while (matching.NextIrreducible())
+      signatures.emplace_back(matching.Id());
+    for (int n : {2 * k, 2 * k + 1, 50, 400}) {
+      std::vector<int> cycle(n);
+      for (int v = 0; v < n; ++v)
+        cycle[v] = v;
+      std::shuffle(cycle.begin(), cycle.end(), engine);
+      Tour tour(cycle);
+      for (int step = 0; step < 600; ++step) {
+        Matching move(signatures[engine() % signatures.size()]);
+        std::vector<int> positions(n);
+        for (int i = 0; i < n; ++i)
+          positions[i] = i;
+        std::shuffle(positions.begin(), positions.end(), engine);
+        positions.resize(k);
+        std::sort(positions.begin(), positions.end());
+        // The same removed edges, as positions on the vector and as the nodes they leave on the tour.
+        SlowEmbedding on_positions(n), on_nodes(n);
+        for (int i = 0; i < k; ++i) {
+          on_positions.SetVal(SigEdge(i), CycleEdge(positions[i]));
+          on_nodes.SetVal(SigEdge(i), CycleEdge(cycle[positions[i]]));
+        }
+        std::vector<int> next;
+        for (auto position : RetrieveSolution(n, move, on_positions))
+          next.emplace_back(cycle[position.id]);
+        tour.Apply(move, on_nodes);
+        // The tour may run in either direction, so the vector follows it.
+        std::rotate(next.begin(), std::find(next.begin(), next.end(), cycle[0]), next.end());
+        if (!Follows(tour, next))
+          std::reverse(next.begin() + 1, next.end());
+        ASSERT_TRUE(Follows(tour, next)) << "k = " << k << ", n = " << n << ", step " << step;
+        cycle = next;
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace kopt
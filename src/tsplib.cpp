@@ -0,0 +1,325 @@
+#include "tsplib.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <thread>
+
+namespace kopt {
+namespace {
+
+constexpr EdgeWeightType kEdgeWeightTypes[] = {
+    EdgeWeightType::kEuc2d, EdgeWeightType::kCeil2d, EdgeWeightType::kAtt,
+    EdgeWeightType::kGeo, EdgeWeightType::kMan2d, EdgeWeightType::kMax2d, EdgeWeightType::kExplicit,
+};
+
+// Sections smaller than this are parsed by a single thread.
+constexpr std::size_t kMinChunkSize = 1 << 20;
+
+bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+std::string_view Trim(std::string_view str) {
+  while (!str.empty() && IsSpace(str.front())) str.remove_prefix(1);
+  while (!str.empty() && IsSpace(str.back())) str.remove_suffix(1);
+  return str;
+}
+
+// Parses the whole string as a number.
+template<class T>
+bool ParseNumber(std::string_view str, T *value) {
+  auto result = std::from_chars(str.data(), str.data() + str.size(), *value);
+  return result.ec == std::errc() && result.ptr == str.data() + str.size();
+}
+
+// Splits the text into lines, keeping track of the line numbers.
+class LineReader {
+ public:
+  explicit LineReader(std::string_view text) : text_(text) {}
+
+  bool Next(std::string_view *line) {
+    if (pos_ >= text_.size())
+      return false;
+    auto end = std::min(text_.find('\n', pos_), text_.size());
+    *line = text_.substr(pos_, end - pos_);
+    last_pos_ = pos_;
+    pos_ = end + 1;
+    ++number_;
+    return true;
+  }
+
+  // Makes the next call of Next return the last line again.
+  void Unread() {
+    pos_ = last_pos_;
+    --number_;
+  }
+
+  // The number of the last line returned by Next, counted from 1.
+  int Number() const { return number_; }
+  std::size_t Pos() const { return std::min(pos_, text_.size()); }
+
+  // Continues reading at pos, which must not be before Pos().
+  void Skip(std::size_t pos) {
+    number_ += static_cast<int>(std::count(text_.begin() + Pos(), text_.begin() + pos, '\n'));
+    pos_ = pos;
+  }
+
+ private:
+  std::string_view text_;
+  std::size_t pos_ = 0, last_pos_ = 0;
+  int number_ = 0;
+};
+
+// Parses a NODE_COORD_SECTION entry: "id x y".
+bool ParseCoordinates(std::string_view line, double *x, double *y) {
+  const char *at = line.data(), *end = line.data() + line.size();
+  auto field = [&]() {
+    while (at < end && IsSpace(*at)) ++at;
+    const char *begin = at;
+    while (at < end && !IsSpace(*at)) ++at;
+    return std::string_view(begin, at - begin);
+  };
+  long id;
+  if (!ParseNumber(field(), &id) || !ParseNumber(field(), x) || !ParseNumber(field(), y))
+    return false;
+  return field().empty();
+}
+
+// A part of the NODE_COORD_SECTION, parsed independently of the others.
+struct CoordinateChunk {
+  std::string_view text;
+  std::vector<double> x, y;
+  // The first malformed line, if any.
+  const char *error = nullptr;
+  std::string_view error_line;
+
+  void Parse() {
+    LineReader reader(text);
+    std::string_view line;
+    while (reader.Next(&line)) {
+      if (Trim(line).empty())
+        continue;
+      double point_x, point_y;
+      if (!ParseCoordinates(line, &point_x, &point_y)) {
+        error = line.data();
+        error_line = Trim(line);
+        return;
+      }
+      x.emplace_back(point_x);
+      y.emplace_back(point_y);
+    }
+  }
+};
+
+// Parses the lines text[begin, end) of the NODE_COORD_SECTION, which start at the given line.
+bool ParseCoordinateSection(std::string_view text, std::size_t begin, std::size_t end, int line_number, int threads,
+                            TsplibData *data, std::string *error) {
+  int chunk_count = static_cast<int>(std::clamp<std::size_t>((end - begin) / kMinChunkSize, 1, std::max(threads, 1)));
+  std::vector<CoordinateChunk> chunks(chunk_count);
+  for (int i = 0; i < chunk_count; ++i) {
+    // The chunks are split at line boundaries.
+    std::size_t chunk_end = end;
+    if (i + 1 < chunk_count) {
+      auto newline = text.find('\n', begin + (end - begin) / (chunk_count - i));
+      chunk_end = newline == std::string_view::npos ? end : std::min(newline + 1, end);
+    }
+    chunks[i].text = text.substr(begin, chunk_end - begin);
+    begin = chunk_end;
+  }
+  std::vector<std::thread> workers;
+  for (int i = 1; i < chunk_count; ++i)
+    workers.emplace_back(&CoordinateChunk::Parse, &chunks[i]);
+  chunks[0].Parse();
+  for (auto &worker : workers)
+    worker.join();
+
+  for (auto &chunk : chunks) {
+    if (chunk.error) {
+      auto first = chunks[0].text.data();
+      line_number += static_cast<int>(std::count(first, chunk.error, '\n'));
+      *error = "line " + std::to_string(line_number) + ": malformed NODE_COORD_SECTION entry '" +
+               std::string(chunk.error_line) + "'";
+      return false;
+    }
+  }
+  std::size_t count = 0;
+  for (auto &chunk : chunks)
+    count += chunk.x.size();
+  data->x.reserve(count + 1);
+  data->y.reserve(count + 1);
+  for (auto &chunk : chunks) {
+    data->x.insert(data->x.end(), chunk.x.begin(), chunk.x.end());
+    data->y.insert(data->y.end(), chunk.y.begin(), chunk.y.end());
+  }
+  return true;
+}
+
+// Reads the EDGE_WEIGHT_SECTION of an EXPLICIT instance, starting at *pos, into a full matrix. On success *pos is the
+// end of the section; on failure it points to the malformed weight.
+bool ParseEdgeWeights(std::string_view text, std::size_t *pos, int n, std::string_view format,
+                      std::vector<std::int32_t> *weights, std::string *error) {
+  // The column-wise formats list the same values as the row-wise formats of the opposite triangle.
+  bool full = format == "FULL_MATRIX";
+  bool upper =
+      format == "UPPER_ROW" || format == "UPPER_DIAG_ROW" || format == "LOWER_COL" || format == "LOWER_DIAG_COL";
+  bool lower =
+      format == "LOWER_ROW" || format == "LOWER_DIAG_ROW" || format == "UPPER_COL" || format == "UPPER_DIAG_COL";
+  if (!full && !upper && !lower) {
+    *error = "unsupported EDGE_WEIGHT_FORMAT '" + std::string(format) + "'";
+    return false;
+  }
+  bool diagonal = full || format.find("DIAG") != std::string_view::npos;
+  weights->assign(std::size_t(n) * n, 0);
+  for (int i = 0; i < n; ++i) {
+    int begin = full || lower ? 0 : diagonal ? i : i + 1;
+    int end = full || upper ? n : diagonal ? i + 1 : i;
+    for (int j = begin; j < end; ++j) {
+      while (*pos < text.size() && IsSpace(text[*pos])) ++*pos;
+      std::size_t token_end = *pos;
+      while (token_end < text.size() && !IsSpace(text[token_end])) ++token_end;
+      std::int32_t weight;
+      if (!ParseNumber(text.substr(*pos, token_end - *pos), &weight)) {
+        *error = *pos == text.size() ? "EDGE_WEIGHT_SECTION ends early"
+                                     : "malformed EDGE_WEIGHT_SECTION entry '" +
+                                       std::string(text.substr(*pos, token_end - *pos)) + "'";
+        return false;
+      }
+      (*weights)[std::size_t(i) * n + j] = weight;
+      if (!full)
+        (*weights)[std::size_t(j) * n + i] = weight;
+      *pos = token_end;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+bool ParseTsplib(std::string_view text, int threads, TsplibData *data, std::string *error) {
+  *data = TsplibData();
+  LineReader reader(text);
+  std::string_view line, format;
+  bool coord_section = false, weight_section = false;
+  auto fail = [&](const std::string &message) {
+    *error = "line " + std::to_string(reader.Number()) + ": " + message;
+    return false;
+  };
+  while (reader.Next(&line)) {
+    auto colon = line.find(':');
+    auto keyword = Trim(line.substr(0, colon));
+    auto value = colon == std::string_view::npos ? std::string_view() : Trim(line.substr(colon + 1));
+    if (keyword == "EOF") {
+      break;
+    } else if (keyword == "EDGE_WEIGHT_TYPE") {
+      auto known = std::find_if(std::begin(kEdgeWeightTypes), std::end(kEdgeWeightTypes),
+                                [value](EdgeWeightType type) { return value == Name(type); });
+      if (known == std::end(kEdgeWeightTypes))
+        return fail("unsupported EDGE_WEIGHT_TYPE '" + std::string(value) + "'");
+      data->type = *known;
+    } else if (keyword == "EDGE_WEIGHT_FORMAT") {
+      format = value;
+    } else if (keyword == "DIMENSION") {
+      if (!ParseNumber(value, &data->dimension) || data->dimension < 0)
+        return fail("malformed DIMENSION '" + std::string(value) + "'");
+    } else if (keyword == "NODE_COORD_SECTION") {
+      // The section ends with the first line starting with a letter, e.g. EOF.
+      std::size_t begin = reader.Pos(), end = begin;
+      int first_line = reader.Number() + 1;
+      while (reader.Next(&line)) {
+        auto trimmed = Trim(line);
+        if (!trimmed.empty() && std::isalpha(static_cast<unsigned char>(trimmed.front()))) {
+          reader.Unread();
+          break;
+        }
+        end = reader.Pos();
+      }
+      if (!ParseCoordinateSection(text, begin, end, first_line, threads, data, error))
+        return false;
+      if (data->dimension && data->dimension != static_cast<int>(data->x.size()))
+        return fail("NODE_COORD_SECTION has " + std::to_string(data->x.size()) + " entries, DIMENSION is " +
+                    std::to_string(data->dimension));
+      coord_section = true;
+    } else if (keyword == "EDGE_WEIGHT_SECTION") {
+      if (data->type != EdgeWeightType::kExplicit || data->dimension <= 0)
+        return fail("EDGE_WEIGHT_SECTION requires EDGE_WEIGHT_TYPE EXPLICIT and a positive DIMENSION");
+      std::size_t pos = reader.Pos();
+      std::string message;
+      if (!ParseEdgeWeights(text, &pos, data->dimension, format, &data->weights, &message)) {
+        int line_number = reader.Number() + 1 + static_cast<int>(std::count(text.begin() + reader.Pos(),
+                                                                             text.begin() + pos, '\n'));
+        *error = "line " + std::to_string(line_number) + ": " + message;
+        return false;
+      }
+      reader.Skip(pos);
+      weight_section = true;
+    }
+  }
+  if (data->type == EdgeWeightType::kExplicit) {
+    if (!weight_section)
+      return fail("missing EDGE_WEIGHT_SECTION");
+  } else {
+    if (!coord_section || data->x.empty())
+      return fail("missing NODE_COORD_SECTION");
+    data->dimension = static_cast<int>(data->x.size());
+  }
+  return true;
+}
+
+bool ParseTour(std::string_view text, int n, std::vector<int> *tour, std::string *error) {
+  tour->clear();
+  LineReader reader(text);
+  std::string_view line;
+  auto fail = [&](const std::string &message) {
+    *error = "line " + std::to_string(reader.Number()) + ": " + message;
+    return false;
+  };
+  while (reader.Next(&line)) {
+    auto colon = line.find(':');
+    auto keyword = Trim(line.substr(0, colon));
+    auto value = colon == std::string_view::npos ? std::string_view() : Trim(line.substr(colon + 1));
+    if (keyword == "EOF") {
+      break;
+    } else if (keyword == "TYPE") {
+      if (value != "TOUR")
+        return fail("unsupported TYPE '" + std::string(value) + "'");
+    } else if (keyword == "DIMENSION") {
+      int dimension;
+      if (!ParseNumber(value, &dimension))
+        return fail("malformed DIMENSION '" + std::string(value) + "'");
+      if (dimension != n)
+        return fail("DIMENSION is " + std::to_string(dimension) + ", the graph has " + std::to_string(n) + " nodes");
+    } else if (keyword == "TOUR_SECTION") {
+      // The tour ends with -1, or with EOF or the end of the file in files which omit it.
+      std::vector<bool> visited(n);
+      std::size_t pos = reader.Pos();
+      auto fail_at = [&](const std::string &message) {
+        reader.Skip(pos);
+        *error = "line " + std::to_string(reader.Number() + 1) + ": " + message;
+        return false;
+      };
+      while (true) {
+        while (pos < text.size() && IsSpace(text[pos])) ++pos;
+        std::size_t end = pos;
+        while (end < text.size() && !IsSpace(text[end])) ++end;
+        auto token = text.substr(pos, end - pos);
+        if (token.empty() || token == "-1" || token == "EOF")
+          break;
+        int id;
+        if (!ParseNumber(token, &id))
+          return fail_at("malformed TOUR_SECTION entry '" + std::string(token) + "'");
+        if (id < 1 || id > n)
+          return fail_at("node " + std::string(token) + " is not in [1, " + std::to_string(n) + "]");
+        if (visited[id - 1])
+          return fail_at("node " + std::string(token) + " appears twice in the tour");
+        visited[id - 1] = true;
+        tour->emplace_back(id - 1);
+        pos = end;
+      }
+      if (Size(*tour) != n)
+        return fail_at("the tour has " + std::to_string(tour->size()) + " nodes, the graph has " + std::to_string(n));
+      return true;
+    }
+  }
+  return fail("missing TOUR_SECTION");
+}
+
+}  // namespace kopt
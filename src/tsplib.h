@@ -0,0 +1,35 @@
+#ifndef KOPT_SRC_TSPLIB_H_
+#define KOPT_SRC_TSPLIB_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "graph.h"
+
+namespace kopt {
+
+// The parts of a TSPLIB file used by kopt.
+struct TsplibData {
+  EdgeWeightType type = EdgeWeightType::kEuc2d;
+  int dimension = 0;
+  // The NODE_COORD_SECTION, in the order of the file.
+  std::vector<double> x, y;
+  // The EDGE_WEIGHT_SECTION as a full dimension * dimension matrix, in row-major order.
+  std::vector<std::int32_t> weights;
+};
+
+// Parses a TSPLIB file. The NODE_COORD_SECTION is split into chunks parsed by up to `threads` threads. Returns false
+// and sets *error (e.g. "line 12: malformed NODE_COORD_SECTION entry '3 1.0'") if the file is malformed or uses an
+// unsupported feature.
+bool ParseTsplib(std::string_view text, int threads, TsplibData *data, std::string *error);
+
+// Parses the first tour of the TOUR_SECTION of a TSPLIB tour file, as written by WriteTours, into the 0-based node ids
+// in the order of the tour. Returns false and sets *error if the file is malformed or the tour does not visit each of
+// the n nodes exactly once.
+bool ParseTour(std::string_view text, int n, std::vector<int> *tour, std::string *error);
+
+}  // namespace kopt
+
+#endif  // KOPT_SRC_TSPLIB_H_
@@ -0,0 +1,43 @@
+#include "weight_matrix.h"
+
+#include <limits>
+
+namespace kopt {
+namespace {
+
+bool FitsNarrow(const std::vector<std::int32_t> &weights) {
+  for (auto weight : weights)
+    if (weight < std::numeric_limits<std::int16_t>::min() || weight > std::numeric_limits<std::int16_t>::max())
+      return false;
+  return true;
+}
+
+}  // namespace
+
+std::shared_ptr<const WeightMatrix> WeightMatrix::Pack(int n, std::vector<std::int32_t> &&weights) {
+  if (std::size_t(n) * n != weights.size())
+    return nullptr;
+  std::shared_ptr<WeightMatrix> matrix(new WeightMatrix());
+  matrix->n_ = n;
+  matrix->narrow_ = FitsNarrow(weights);
+  if (matrix->narrow_) {
+    matrix->owned16_.assign(weights.begin(), weights.end());
+    matrix->data_ = matrix->owned16_.data();
+  } else {
+    matrix->owned32_ = std::move(weights);
+    matrix->data_ = matrix->owned32_.data();
+  }
+  return matrix;
+}
+
+std::shared_ptr<const WeightMatrix> WeightMatrix::Map(int n, bool narrow, const void *data,
+                                                      std::shared_ptr<const MappedFile> file) {
+  std::shared_ptr<WeightMatrix> matrix(new WeightMatrix());
+  matrix->n_ = n;
+  matrix->narrow_ = narrow;
+  matrix->data_ = data;
+  matrix->file_ = std::move(file);
+  return matrix;
+}
+
+}  // namespace kopt
@@ -0,0 +1,68 @@
+#ifndef KOPT_SRC_WEIGHT_MATRIX_H_
+#define KOPT_SRC_WEIGHT_MATRIX_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "mapped_file.h"
+
+namespace kopt {
+
+// A square matrix of edge weights, indexed by the original node ids and stored row by row as 16-bit integers if all the
+// weights fit, or as 32-bit integers otherwise. The storage is either owned or part of a memory-mapped file, e.g. an
+// instance cache, so that large EXPLICIT instances are parsed only once.
+class WeightMatrix {
+ public:
+  // Packs the n * n weights given in row-major order. Returns nullptr if n * n != weights.size().
+  static std::shared_ptr<const WeightMatrix> Pack(int n, std::vector<std::int32_t> &&weights);
+  // Uses the n * n weights at data, of the width given by narrow, which lie within the file. The file stays mapped as
+  // long as the matrix is used.
+  static std::shared_ptr<const WeightMatrix> Map(int n, bool narrow, const void *data,
+                                                 std::shared_ptr<const MappedFile> file);
+  // Allocates n * n weights of the width given by narrow and lets fill write them, given a pointer to either
+  // std::int16_t or std::int32_t. Returns nullptr if fill returns false, e.g. on a weight which does not fit.
+  template<class Fill>
+  static std::shared_ptr<const WeightMatrix> Build(int n, bool narrow, Fill &&fill);
+
+  WeightMatrix(const WeightMatrix &) = delete;
+  WeightMatrix &operator=(const WeightMatrix &) = delete;
+
+  int N() const { return n_; }
+  bool Narrow() const { return narrow_; }
+  // The weights, only valid for the width matching Narrow().
+  const std::int16_t *Data16() const { return static_cast<const std::int16_t *>(data_); }
+  const std::int32_t *Data32() const { return static_cast<const std::int32_t *>(data_); }
+
+ private:
+  WeightMatrix() = default;
+
+  int n_ = 0;
+  bool narrow_ = false;
+  const void *data_ = nullptr;
+  std::vector<std::int16_t> owned16_;
+  std::vector<std::int32_t> owned32_;
+  std::shared_ptr<const MappedFile> file_;
+};
+
+template<class Fill>
+std::shared_ptr<const WeightMatrix> WeightMatrix::Build(int n, bool narrow, Fill &&fill) {
+  std::shared_ptr<WeightMatrix> matrix(new WeightMatrix());
+  matrix->n_ = n;
+  matrix->narrow_ = narrow;
+  bool filled;
+  if (narrow) {
+    matrix->owned16_.resize(std::size_t(n) * n);
+    matrix->data_ = matrix->owned16_.data();
+    filled = fill(matrix->owned16_.data());
+  } else {
+    matrix->owned32_.resize(std::size_t(n) * n);
+    matrix->data_ = matrix->owned32_.data();
+    filled = fill(matrix->owned32_.data());
+  }
+  return filled ? matrix : nullptr;
+}
+
+}  // namespace kopt
+
+#endif  // KOPT_SRC_WEIGHT_MATRIX_H_